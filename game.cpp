@@ -5,22 +5,418 @@
 #include <unistd.h>
 #include <ctime>
 #include <algorithm>
+#include <queue>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <atomic>
+#ifdef SPECTATOR
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#ifdef COROUTINES
+#include <coroutine>
+#endif
+
+// Largest width or height a coordinate can hold. 8.8 fixed point (see Coord)
+// wraps at 128 cells; the margin covers entities stepping past the edge.
+#if defined(FIXED_POINT) && FIXED_POINT == 8
+const int MAX_GRID_CELLS = 120;
+#else
+const int MAX_GRID_CELLS = 1000;
+#endif
+
+// Shipped game presets. Every parameter is a constexpr function, so the entity
+// code instantiated with a preset is compiled with all of them folded in.
+// A preset derives from ClassicPreset<itself> and overrides what it changes;
+// values computed from other parameters go through 'C', so they follow the
+// overrides.
+template <class C>
+struct ClassicPreset
+{
+    // Scenario dimensions
+    static constexpr int width() { return 50; }
+    static constexpr int height() { return 20; }
+
+    // Depot position (bottom center of the screen)
+    static constexpr int depot_x() { return C::width() / 2; }
+    static constexpr int depot_y() { return C::height() - 2; }
+
+    // Difficulty parameters
+    static constexpr int hits_to_kill() { return 3; }     // Hits required to kill a dinosaur
+    static constexpr int missile_capacity() { return 5; } // Helicopter missile capacity
+    static constexpr int spawn_interval() { return 10; }  // Time between dinosaur spawns (in seconds)
+    static constexpr int max_dinosaurs() { return 4; }    // Game over once this many are alive
+    static constexpr int max_trucks() { return 3; }       // Trucks on the road at once
+
+    // Entity motion, in cells per second (gravity in cells per second squared)
+    static constexpr double missile_speed() { return 20; }
+    static constexpr double dinosaur_speed() { return 5; }
+    static constexpr double gravity() { return 20; }
+    static constexpr double jump_strength() { return -10; }
+    static constexpr double jump_rate() { return 1; } // Average jumps per second
+    static constexpr double truck_speed() { return 2; }
+
+    // Sleep intervals (in microseconds). Missiles and dinosaurs step at the
+    // fixed sim_tick rate; the renderer interpolates between their steps.
+    static constexpr int sim_tick() { return 50000; }
+    static constexpr int truck_tick() { return 500000; }
+    static constexpr int truck_unload_time() { return 2000000; }
+    static constexpr int truck_interval() { return 1000000; }
+    static constexpr int spawner_tick() { return 500000; }
+    static constexpr int input_tick() { return 10000; }
+    static constexpr int render_tick() { return 25000; }
+};
+
+struct ClassicConfig : ClassicPreset<ClassicConfig>
+{
+};
+
+// Faster spawns and tougher dinosaurs
+struct HardConfig : ClassicPreset<HardConfig>
+{
+    static constexpr int hits_to_kill() { return 5; }
+    static constexpr int spawn_interval() { return 5; }
+    static constexpr double dinosaur_speed() { return 8; }
+};
+
+static_assert(ClassicConfig::width() <= MAX_GRID_CELLS && ClassicConfig::height() <= MAX_GRID_CELLS,
+              "ClassicConfig grid does not fit in Coord");
+static_assert(HardConfig::width() <= MAX_GRID_CELLS && HardConfig::height() <= MAX_GRID_CELLS,
+              "HardConfig grid does not fit in Coord");
+
+// Values behind RuntimeConfig, adjustable from the command line
+struct GameSettings
+{
+    int width;
+    int height;
+    int hits_to_kill;
+    int missile_capacity;
+    int spawn_interval;
+    int max_dinosaurs;
+    int max_trucks;
+    double missile_speed;
+    double dinosaur_speed;
+    double gravity;
+    double jump_strength;
+    double jump_rate;
+    double truck_speed;
+    int sim_tick;
+    int truck_tick;
+    int truck_unload_time;
+    int truck_interval;
+    int spawner_tick;
+    int input_tick;
+    int render_tick;
+
+    template <class C>
+    static GameSettings from()
+    {
+        GameSettings s = {C::width(), C::height(), C::hits_to_kill(), C::missile_capacity(),
+                          C::spawn_interval(), C::max_dinosaurs(), C::max_trucks(), C::missile_speed(),
+                          C::dinosaur_speed(), C::gravity(), C::jump_strength(), C::jump_rate(),
+                          C::truck_speed(), C::sim_tick(), C::truck_tick(),
+                          C::truck_unload_time(), C::truck_interval(), C::spawner_tick(),
+                          C::input_tick(), C::render_tick()};
+        return s;
+    }
+
+    bool set(const char *arg);
+
+    // Whether a jump peaks on screen: v^2 / 2g cells above the ground at most
+    bool jump_fits() const
+    {
+        return jump_strength * jump_strength / (2 * gravity) <= height - 2;
+    }
+};
+
+GameSettings runtime_settings = GameSettings::from<ClassicConfig>();
+
+// Configuration read at runtime, for experiments without recompiling
+struct RuntimeConfig
+{
+    static int width() { return runtime_settings.width; }
+    static int height() { return runtime_settings.height; }
+    static int depot_x() { return width() / 2; }
+    static int depot_y() { return height() - 2; }
+    static int hits_to_kill() { return runtime_settings.hits_to_kill; }
+    static int missile_capacity() { return runtime_settings.missile_capacity; }
+    static int spawn_interval() { return runtime_settings.spawn_interval; }
+    static int max_dinosaurs() { return runtime_settings.max_dinosaurs; }
+    static int max_trucks() { return runtime_settings.max_trucks; }
+    static double missile_speed() { return runtime_settings.missile_speed; }
+    static double dinosaur_speed() { return runtime_settings.dinosaur_speed; }
+    static double gravity() { return runtime_settings.gravity; }
+    static double jump_strength() { return runtime_settings.jump_strength; }
+    static double jump_rate() { return runtime_settings.jump_rate; }
+    static double truck_speed() { return runtime_settings.truck_speed; }
+    static int sim_tick() { return runtime_settings.sim_tick; }
+    static int truck_tick() { return runtime_settings.truck_tick; }
+    static int truck_unload_time() { return runtime_settings.truck_unload_time; }
+    static int truck_interval() { return runtime_settings.truck_interval; }
+    static int spawner_tick() { return runtime_settings.spawner_tick; }
+    static int input_tick() { return runtime_settings.input_tick; }
+    static int render_tick() { return runtime_settings.render_tick; }
+};
+
+// Parse a single "name=value" argument. Returns false, leaving the settings
+// unchanged, for an unknown name or a value that is not a number in range.
+bool GameSettings::set(const char *arg)
+{
+    struct Field
+    {
+        const char *name;
+        int *int_value;
+        double *double_value;
+        double min;
+        double max;
+    };
+    const Field fields[] = {
+        {"width", &width, nullptr, 10, MAX_GRID_CELLS},
+        {"height", &height, nullptr, 5, MAX_GRID_CELLS},
+        {"hits_to_kill", &hits_to_kill, nullptr, 1, 1000},
+        {"missile_capacity", &missile_capacity, nullptr, 1, 1000},
+        {"spawn_interval", &spawn_interval, nullptr, 1, 3600},
+        {"max_dinosaurs", &max_dinosaurs, nullptr, 1, 1000},
+        {"max_trucks", &max_trucks, nullptr, 1, 100},
+        {"missile_speed", nullptr, &missile_speed, 0.1, 1000},
+        {"dinosaur_speed", nullptr, &dinosaur_speed, 0.1, 1000},
+        {"gravity", nullptr, &gravity, 0.1, 1000},
+        {"jump_strength", nullptr, &jump_strength, -1000, 0},
+        {"jump_rate", nullptr, &jump_rate, 0, 100},
+        {"truck_speed", nullptr, &truck_speed, 0.1, 1000},
+        {"sim_tick", &sim_tick, nullptr, 1000, 10000000},
+        {"truck_tick", &truck_tick, nullptr, 1000, 10000000},
+        {"truck_unload_time", &truck_unload_time, nullptr, 0, 60000000},
+        {"truck_interval", &truck_interval, nullptr, 1000, 60000000},
+        {"spawner_tick", &spawner_tick, nullptr, 1000, 10000000},
+        {"input_tick", &input_tick, nullptr, 1000, 1000000},
+        {"render_tick", &render_tick, nullptr, 1000, 1000000},
+    };
+
+    const char *eq = strchr(arg, '=');
+    if (!eq)
+        return false;
+    for (const Field &f : fields)
+    {
+        if (strlen(f.name) == static_cast<size_t>(eq - arg) && strncmp(f.name, arg, eq - arg) == 0)
+        {
+            const char *text = eq + 1;
+            char *end;
+            errno = 0;
+            double value = f.int_value ? strtol(text, &end, 10) : strtod(text, &end);
+            if (end == text || *end != '\0' || errno != 0 || !(value >= f.min && value <= f.max))
+                return false;
+            if (f.int_value)
+                *f.int_value = static_cast<int>(value);
+            else
+                *f.double_value = value;
+            return true;
+        }
+    }
+    return false;
+}
 
-// Scenario dimensions
-const int WIDTH = 50;
-const int HEIGHT = 20;
+// Length of one simulation step (in seconds)
+template <class C>
+constexpr double sim_dt()
+{
+    return C::sim_tick() / 1e6;
+}
 
-// Difficulty parameters
-int m = 3;  // Hits required to kill a dinosaur
-int n = 5;  // Helicopter missile capacity
-int t = 10; // Time interval between dinosaur spawns (in seconds)
+// Configuration the game is built with
+#if defined(RUNTIME_CONFIG)
+typedef RuntimeConfig Config;
+#elif defined(HARD_MODE)
+typedef HardConfig Config;
+#else
+typedef ClassicConfig Config;
+#endif
 
 // Forward declarations
-class Truck;
+template <class C>
+class BasicTruck;
 class Depot;
 class Helicopter;
-class Missile;
-class Dinosaur;
+template <class C>
+class BasicMissile;
+template <class C>
+class BasicDinosaur;
+
+typedef BasicTruck<Config> Truck;
+typedef BasicMissile<Config> Missile;
+typedef BasicDinosaur<Config> Dinosaur;
+
+// Tracing (-DTRACING): begin/end events go into per-thread ring buffers and are
+// written as Chrome Trace Event JSON on exit. Without it the macros expand to
+// plain locks and nothing else.
+#ifdef TRACING
+const size_t TRACE_BUFFER_EVENTS = 16384;
+const char *const TRACE_FILE = "trace.json";
+
+struct TraceEvent
+{
+    const char *name; // Always a string literal
+    long long ts_ns;
+    int tid;
+    char phase; // 'B' or 'E'
+};
+
+// Ring buffer written by one thread at a time. When its thread exits it is
+// handed to the next thread of the same name that starts, so short-lived
+// missile and dinosaur threads don't each keep a buffer alive. Each buffer is
+// one timeline row, so rows and names stay bounded by the peak thread count.
+struct TraceBuffer
+{
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    size_t count;     // Total events written; the ring keeps the most recent ones
+    int tid;          // Timeline row
+    const char *name; // Name of the threads that write it
+};
+
+pthread_mutex_t mtx_trace = PTHREAD_MUTEX_INITIALIZER;
+std::vector<TraceBuffer *> trace_buffers;
+std::vector<TraceBuffer *> free_trace_buffers;
+
+// Buffer owned by the calling thread, returned to the pool when it exits
+struct TraceThread
+{
+    TraceBuffer *buffer;
+
+    TraceThread() : buffer(nullptr) {}
+
+    ~TraceThread()
+    {
+        if (buffer)
+        {
+            pthread_mutex_lock(&mtx_trace);
+            free_trace_buffers.push_back(buffer);
+            pthread_mutex_unlock(&mtx_trace);
+        }
+    }
+};
+
+thread_local TraceThread trace_thread;
+
+long long trace_now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Give the calling thread a buffer, reusing the row of an exited thread of
+// the same name when there is one
+void trace_thread_start(const char *name)
+{
+    pthread_mutex_lock(&mtx_trace);
+    TraceBuffer *buffer = nullptr;
+    for (size_t i = 0; i < free_trace_buffers.size(); i++)
+    {
+        if (strcmp(free_trace_buffers[i]->name, name) == 0)
+        {
+            buffer = free_trace_buffers[i];
+            free_trace_buffers[i] = free_trace_buffers.back();
+            free_trace_buffers.pop_back();
+            break;
+        }
+    }
+    if (!buffer)
+    {
+        buffer = new TraceBuffer();
+        buffer->count = 0;
+        buffer->tid = static_cast<int>(trace_buffers.size()) + 1;
+        buffer->name = name;
+        trace_buffers.push_back(buffer);
+    }
+    trace_thread.buffer = buffer;
+    pthread_mutex_unlock(&mtx_trace);
+}
+
+void trace_event(const char *name, char phase)
+{
+    if (!trace_thread.buffer)
+        trace_thread_start("thread");
+
+    TraceBuffer *buffer = trace_thread.buffer;
+    TraceEvent &e = buffer->events[buffer->count % TRACE_BUFFER_EVENTS];
+    e.name = name;
+    e.ts_ns = trace_now_ns();
+    e.tid = buffer->tid;
+    e.phase = phase;
+    buffer->count++;
+}
+
+// Records a begin/end pair around the enclosing scope
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : name(name) { trace_event(name, 'B'); }
+    ~TraceScope() { trace_event(name, 'E'); }
+
+private:
+    const char *name;
+};
+
+// Lock a mutex, recording a wait event only if it was contended
+void trace_lock(pthread_mutex_t *mtx, const char *wait_name)
+{
+    if (pthread_mutex_trylock(mtx) == 0)
+        return;
+    trace_event(wait_name, 'B');
+    pthread_mutex_lock(mtx);
+    trace_event(wait_name, 'E');
+}
+
+// Write every buffered event to TRACE_FILE. Call once all other threads are joined.
+void trace_write()
+{
+    FILE *f = fopen(TRACE_FILE, "w");
+    if (!f)
+        return;
+
+    int pid = static_cast<int>(getpid());
+    const char *sep = "";
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (TraceBuffer *buffer : trace_buffers)
+    {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                sep, pid, buffer->tid, buffer->name);
+        sep = ",\n";
+    }
+    for (TraceBuffer *buffer : trace_buffers)
+    {
+        size_t kept = std::min(buffer->count, TRACE_BUFFER_EVENTS);
+        for (size_t i = buffer->count - kept; i < buffer->count; i++)
+        {
+            const TraceEvent &e = buffer->events[i % TRACE_BUFFER_EVENTS];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    sep, e.name, e.phase, e.ts_ns / 1000.0, pid, e.tid);
+            sep = ",\n";
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
+
+#define TRACE_THREAD(name) trace_thread_start(name)
+#define TRACE_BEGIN(name) trace_event(name, 'B')
+#define TRACE_END(name) trace_event(name, 'E')
+#define TRACE_SCOPE(name) TraceScope trace_scope(name)
+#define TRACED_LOCK(mtx) trace_lock(&(mtx), "wait " #mtx)
+#define TRACE_WRITE() trace_write()
+#else
+#define TRACE_THREAD(name)
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_SCOPE(name)
+#define TRACED_LOCK(mtx) pthread_mutex_lock(&(mtx))
+#define TRACE_WRITE()
+#endif
 
 // Global variables
 Helicopter *heli_ptr; // Pointer to the helicopter object
@@ -30,419 +426,1009 @@ std::vector<Truck *> active_trucks;
 pthread_mutex_t mtx_missiles = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t mtx_dinosaurs = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t mtx_trucks = PTHREAD_MUTEX_INITIALIZER;
-bool running = true;
+std::atomic<bool> running(true);
 pthread_mutex_t mtx_running = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cv_running; // Broadcast when the game stops; set up in main() by init_wait_cond()
+
+#ifdef COROUTINES
+void wake_scheduler();
+#endif
+
+// Timed waits run on the monotonic clock so a wall-clock jump can neither stall
+// nor cut short a sleep. macOS has no pthread_condattr_setclock().
+#ifdef __APPLE__
+const clockid_t WAIT_CLOCK = CLOCK_REALTIME;
+#else
+const clockid_t WAIT_CLOCK = CLOCK_MONOTONIC;
+#endif
+
+// Initialize a condition variable whose timed waits take deadline_after() values
+void init_wait_cond(pthread_cond_t *cv)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifndef __APPLE__
+    pthread_condattr_setclock(&attr, WAIT_CLOCK);
+#endif
+    pthread_cond_init(cv, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Absolute WAIT_CLOCK deadline 'usec' microseconds from now, for timed waits
+timespec deadline_after(long long usec)
+{
+    timespec deadline;
+    clock_gettime(WAIT_CLOCK, &deadline);
+    long long nsec = deadline.tv_nsec + usec * 1000LL;
+    deadline.tv_sec += nsec / 1000000000LL;
+    deadline.tv_nsec = nsec % 1000000000LL;
+    return deadline;
+}
+
+void wake_entities();
 
 // Function to safely set the running flag
 void set_running(bool value)
 {
-    pthread_mutex_lock(&mtx_running);
+    TRACED_LOCK(mtx_running);
     running = value;
+    pthread_cond_broadcast(&cv_running);
     pthread_mutex_unlock(&mtx_running);
+
+    if (!value)
+    {
+#ifdef COROUTINES
+        wake_scheduler();
+#endif
+        wake_entities();
+    }
 }
 
-// Function to safely check if the game is running
-bool is_running()
+// Sleep for up to 'usec' microseconds, returning early once the game stops.
+// For the game-wide threads; entities sleep on their own condvar instead.
+bool sleep_while_running(int usec)
 {
-    pthread_mutex_lock(&mtx_running);
+    timespec deadline = deadline_after(usec);
+
+    TRACED_LOCK(mtx_running);
+    while (running)
+    {
+        if (pthread_cond_timedwait(&cv_running, &mtx_running, &deadline) == ETIMEDOUT)
+            break;
+    }
     bool result = running;
     pthread_mutex_unlock(&mtx_running);
     return result;
 }
 
-// Depot position
-const int DEPOT_X = WIDTH / 2;
-const int DEPOT_Y = HEIGHT - 2; // Bottom center of the screen
-
-// Class to represent a missile
-class Missile
+// Sleep on an entity's own 'mtx'/'cv' for up to 'usec' microseconds, returning
+// early once the game stops or '*alive' turns false. Whoever clears '*alive'
+// from another thread does it under 'mtx' and signals 'cv', so stopping one
+// entity wakes only that entity. Returns whether the caller should keep going.
+bool sleep_while_alive(int usec, pthread_mutex_t *mtx, pthread_cond_t *cv, const bool *alive)
 {
-public:
-    double x;
-    double y;
-    int direction; // -1 for left, 1 for right
-    bool active;
-    pthread_t th;
+    timespec deadline = deadline_after(usec);
 
-    Missile(double startX, double startY, int dir)
-        : x(startX), y(startY), direction(dir), active(true), th(0) {}
-
-    static void *move_wrapper(void *arg)
+    pthread_mutex_lock(mtx);
+    while (running && *alive)
     {
-        Missile *m = static_cast<Missile *>(arg);
-        m->move();
-        return nullptr;
+        if (pthread_cond_timedwait(cv, mtx, &deadline) == ETIMEDOUT)
+            break;
     }
+    bool result = running && *alive;
+    pthread_mutex_unlock(mtx);
+    return result;
+}
 
-    void start()
-    {
-        pthread_create(&th, nullptr, Missile::move_wrapper, this);
-    }
+// Function to safely check if the game is running
+bool is_running()
+{
+    return running;
+}
 
-    void move()
-    {
-        double speed = 0.5;
-        while (active && x > 1 && x < WIDTH - 2)
-        {
-            double prev_x = x;
-            x += direction * speed;
-            check_collision(prev_x, x);
-            usleep(25000);
-        }
-        active = false;
-    }
+// Gameplay event log (-DEVENT_LOG): fixed-size binary records go into
+// per-thread single-producer rings and a flusher thread appends them to
+// EVENT_LOG_FILE in large writes. Logging never allocates, locks or does I/O;
+// when a ring is full the record is dropped and counted instead.
+//
+// File layout: the 8-byte magic "DINOLOG1", then EventRecord structs as laid
+// out in memory (24 bytes each, native byte order).
+enum EventType
+{
+    EVENT_MISSILE_FIRED = 1, // a, b: cell; c: direction
+    EVENT_HEAD_HIT,          // a, b: cell of the missile
+    EVENT_BODY_BLOCK,        // a, b: cell of the missile
+    EVENT_DINOSAUR_KILLED,   // a, b: cell of the dinosaur
+    EVENT_DEPOT_UNLOAD,      // a: missiles unloaded; b: depot stock after
+    EVENT_DEPOT_RELOAD,      // a: missiles taken; b: depot stock after
+    EVENT_TRUCK_ARRIVED,     // a: cargo; b: missiles unloaded
+    EVENT_GAME_OVER          // a: 0 quit, 1 caught by a dinosaur, 2 too many dinosaurs
+};
 
-    void draw()
-    {
-        if (active)
-        {
-            char missile_char = (direction == 1) ? '>' : '<';
-            mvprintw(static_cast<int>(y), static_cast<int>(x), "%c", missile_char);
-        }
-    }
+#ifdef EVENT_LOG
+const size_t EVENT_RING_RECORDS = 4096;
+const int EVENT_RING_POOL = 64; // Rings allocated up front; threads beyond this many log nothing
+const size_t EVENT_WRITE_RECORDS = 16384; // Records per write to the file
+const int EVENT_FLUSH_US = 100000;
+const int EVENT_WRITE_ROUNDS = 10; // Flush rounds between writes of a partly filled staging buffer
+const char *const EVENT_LOG_FILE = "events.bin";
 
-    void join()
-    {
-        if (th)
-        {
-            pthread_join(th, nullptr);
-            th = 0;
-        }
-    }
+struct EventRecord
+{
+    int64_t ts_ns; // CLOCK_MONOTONIC
+    int32_t type;  // EventType
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
 
-    void check_collision(double prev_x, double curr_x);
+// Ring written by one thread and drained by the flusher. Rings come from a pool
+// allocated by event_log_start(); a thread binds one when it starts and hands
+// it back when it exits.
+struct EventRing
+{
+    EventRecord records[EVENT_RING_RECORDS];
+    std::atomic<size_t> head;    // Records written, advanced by the owning thread
+    std::atomic<size_t> tail;    // Records drained, advanced by the flusher
+    std::atomic<size_t> dropped; // Records lost to a full ring
 };
 
-// Class to represent a dinosaur
-class Dinosaur
+pthread_mutex_t mtx_event_log = PTHREAD_MUTEX_INITIALIZER;
+EventRing *event_rings = nullptr;          // EVENT_RING_POOL rings, fixed while the log is open
+std::vector<EventRing *> free_event_rings; // Capacity for the whole pool, so returning never allocates
+std::atomic<size_t> events_unbound(0);     // Events from threads that found the pool empty
+FILE *event_file = nullptr;
+EventRecord event_staging[EVENT_WRITE_RECORDS]; // Only touched by the flusher
+size_t event_staged = 0;
+size_t events_written = 0;
+pthread_t event_flusher;
+
+// Ring owned by the calling thread, returned to the pool when it exits
+struct EventThread
 {
-public:
-    double x;
-    double y;
-    int health;
-    bool active;
-    pthread_t th;
-    pthread_mutex_t mtx;
-    int direction; // 1 for right, -1 for left
+    EventRing *ring;
 
-    // Jumping variables
-    bool is_jumping;
-    double vertical_velocity;
+    EventThread() : ring(nullptr) {}
 
-    Dinosaur(double startX, double startY, int initial_health, int initial_direction = -1)
-        : x(startX), y(startY), health(initial_health), active(true), th(0),
-          direction(initial_direction), is_jumping(false), vertical_velocity(0)
+    ~EventThread()
     {
-        pthread_mutex_init(&mtx, nullptr);
+        if (ring)
+        {
+            pthread_mutex_lock(&mtx_event_log);
+            free_event_rings.push_back(ring);
+            pthread_mutex_unlock(&mtx_event_log);
+        }
     }
+};
 
-    ~Dinosaur()
-    {
-        pthread_mutex_destroy(&mtx);
-    }
+thread_local EventThread event_thread;
 
-    static void *move_wrapper(void *arg)
+// Take a ring from the pool for the calling thread. Done when a thread starts,
+// before it holds any game lock, so logging itself never locks or allocates.
+void event_log_bind_thread()
+{
+    pthread_mutex_lock(&mtx_event_log);
+    if (!event_thread.ring && !free_event_rings.empty())
     {
-        Dinosaur *d = static_cast<Dinosaur *>(arg);
-        d->move();
-        return nullptr;
+        event_thread.ring = free_event_rings.back();
+        free_event_rings.pop_back();
     }
+    pthread_mutex_unlock(&mtx_event_log);
+}
 
-    void start()
+void log_event(EventType type, int a, int b, int c)
+{
+    EventRing *ring = event_thread.ring;
+    if (!ring)
     {
-        pthread_create(&th, nullptr, Dinosaur::move_wrapper, this);
+        if (event_rings)
+            events_unbound.fetch_add(1, std::memory_order_relaxed);
+        return;
     }
-
-    void move()
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == EVENT_RING_RECORDS)
     {
-        double speed = 0.25;
-        double gravity = 0.05;
-        double jump_strength = -0.5;
-
-        while (active)
-        {
-            x += direction * speed;
-
-            // Change direction at boundaries
-            if (x <= 1)
-            {
-                x = 1;
-                direction = 1;
-            }
-            else if (x >= WIDTH - 2)
-            {
-                x = WIDTH - 2;
-                direction = -1;
-            }
-
-            // Handle vertical movement
-            if (is_jumping)
-            {
-                vertical_velocity += gravity;
-                y += vertical_velocity;
-
-                if (y >= HEIGHT - 2)
-                {
-                    y = HEIGHT - 2;
-                    is_jumping = false;
-                    vertical_velocity = 0;
-                }
-            }
-            else
-            {
-                y = HEIGHT - 2;
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
 
-                // Random chance to start a jump
-                if (rand() % 100 < 5)
-                {
-                    is_jumping = true;
-                    vertical_velocity = jump_strength;
-                }
-            }
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    EventRecord &r = ring->records[head % EVENT_RING_RECORDS];
+    r.ts_ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    r.type = type;
+    r.a = a;
+    r.b = b;
+    r.c = c;
+    ring->head.store(head + 1, std::memory_order_release);
+}
 
-            check_collision();
-            usleep(50000);
-        }
+void write_staged_events()
+{
+    if (event_staged > 0)
+    {
+        fwrite(event_staging, sizeof(EventRecord), event_staged, event_file);
+        events_written += event_staged;
+        event_staged = 0;
     }
+}
 
-    void draw()
+// Move everything the rings hold into the staging buffer, writing it out
+// each time it fills up. With 'all' set, also write the partial remainder.
+void drain_events(bool all)
+{
+    for (int i = 0; i < EVENT_RING_POOL; i++)
     {
-        if (active)
+        EventRing *ring = &event_rings[i];
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++)
         {
-            int draw_x = static_cast<int>(x);
-            int draw_y = static_cast<int>(y);
-
-            mvprintw(draw_y, draw_x, "D"); // Dinosaur body
-            int head_x = draw_x + direction;
-            mvprintw(draw_y - 1, head_x, "O"); // Dinosaur head
+            event_staging[event_staged++] = ring->records[tail % EVENT_RING_RECORDS];
+            if (event_staged == EVENT_WRITE_RECORDS)
+                write_staged_events();
         }
+        ring->tail.store(tail, std::memory_order_release);
     }
+    if (all)
+        write_staged_events();
+}
 
-    void join()
+// Drain the rings every round; write out what is staged every few rounds even
+// if the buffer is not full, so events reach the file during the game
+void *thread_event_flusher(void *arg)
+{
+    TRACE_THREAD("thread_event_flusher");
+    int round = 0;
+    while (sleep_while_running(EVENT_FLUSH_US))
     {
-        if (th)
-        {
-            pthread_join(th, nullptr);
-            th = 0;
-        }
+        bool write_now = ++round % EVENT_WRITE_ROUNDS == 0;
+        drain_events(write_now);
+        if (write_now)
+            fflush(event_file);
     }
+    return nullptr;
+}
 
-    void take_damage()
+void event_log_start()
+{
+    event_file = fopen(EVENT_LOG_FILE, "wb");
+    if (event_file)
     {
-        pthread_mutex_lock(&mtx);
-        health--;
-        if (health <= 0)
+        event_rings = new EventRing[EVENT_RING_POOL];
+        free_event_rings.reserve(EVENT_RING_POOL);
+        for (int i = EVENT_RING_POOL - 1; i >= 0; i--)
         {
-            active = false;
+            event_rings[i].head = 0;
+            event_rings[i].tail = 0;
+            event_rings[i].dropped = 0;
+            free_event_rings.push_back(&event_rings[i]);
         }
-        pthread_mutex_unlock(&mtx);
+        events_unbound = 0;
+        fwrite("DINOLOG1", 1, 8, event_file);
+        pthread_create(&event_flusher, nullptr, thread_event_flusher, nullptr);
     }
+}
 
-    void check_collision();
-};
+// Write what is left, close the file and free the rings. Call once all other
+// threads are joined, so every ring is back in the pool.
+void event_log_stop()
+{
+    if (!event_file)
+        return;
+    pthread_join(event_flusher, nullptr);
+    drain_events(true);
+    fclose(event_file);
+    event_file = nullptr;
+
+    size_t dropped = events_unbound;
+    for (int i = 0; i < EVENT_RING_POOL; i++)
+        dropped += event_rings[i].dropped;
+    printf("Event log: %zu events written to %s, %zu dropped\n", events_written, EVENT_LOG_FILE, dropped);
+
+    free_event_rings.clear();
+    delete[] event_rings;
+    event_rings = nullptr;
+}
 
-// Class to represent the depot
-class Depot
+#define LOG_EVENT(type, a, b, c) log_event(type, a, b, c)
+#define EVENT_LOG_START() event_log_start()
+#define EVENT_LOG_STOP() event_log_stop()
+#define EVENT_LOG_THREAD() event_log_bind_thread()
+#else
+#define LOG_EVENT(type, a, b, c)
+#define EVENT_LOG_START()
+#define EVENT_LOG_STOP()
+#define EVENT_LOG_THREAD()
+#endif
+
+// Fixed-point number with FracBits fractional bits stored in Rep. Arithmetic is
+// integer-only, so the simulation is bit-exact across compilers and CPUs, and
+// the grid cell of a coordinate is a single shift.
+template <class Rep, int FracBits>
+class Fixed
 {
 public:
-    int capacity; // Total capacity (n slots)
-    int missiles; // Current number of missiles
-    bool is_truck_unloading;
-    bool is_helicopter_reloading;
-    pthread_mutex_t mtx;
-    pthread_cond_t cv_truck;
-    pthread_cond_t cv_helicopter;
+    Rep raw;
 
-    Depot(int capacity)
-        : capacity(capacity), missiles(capacity),
-          is_truck_unloading(false), is_helicopter_reloading(false)
+    constexpr Fixed() : raw(0) {}
+    constexpr Fixed(int value) : raw(static_cast<Rep>(value * (1 << FracBits))) {}
+    // Rounded to the nearest step; for constants this happens at compile time
+    constexpr Fixed(double value)
+        : raw(static_cast<Rep>(value * (1 << FracBits) + (value < 0 ? -0.5 : 0.5))) {}
+
+    static Fixed from_raw(Rep r)
     {
-        pthread_mutex_init(&mtx, nullptr);
-        pthread_cond_init(&cv_truck, nullptr);
-        pthread_cond_init(&cv_helicopter, nullptr);
+        Fixed f;
+        f.raw = r;
+        return f;
     }
 
-    ~Depot()
+    int cell() const { return raw >> FracBits; }
+    double to_double() const { return static_cast<double>(raw) / (1 << FracBits); }
+
+    Fixed &operator+=(Fixed o)
     {
-        pthread_mutex_destroy(&mtx);
-        pthread_cond_destroy(&cv_truck);
-        pthread_cond_destroy(&cv_helicopter);
+        raw = static_cast<Rep>(raw + o.raw);
+        return *this;
     }
-
-    void truck_unload(int amount);
-    void helicopter_reload(int amount);
+    Fixed &operator-=(Fixed o)
+    {
+        raw = static_cast<Rep>(raw - o.raw);
+        return *this;
+    }
+    Fixed operator-() const { return from_raw(static_cast<Rep>(-raw)); }
+
+    friend Fixed operator+(Fixed a, Fixed b) { return a += b; }
+    friend Fixed operator-(Fixed a, Fixed b) { return a -= b; }
+    friend Fixed operator*(int k, Fixed a) { return from_raw(static_cast<Rep>(k * a.raw)); }
+    friend bool operator==(Fixed a, Fixed b) { return a.raw == b.raw; }
+    friend bool operator!=(Fixed a, Fixed b) { return a.raw != b.raw; }
+    friend bool operator<(Fixed a, Fixed b) { return a.raw < b.raw; }
+    friend bool operator<=(Fixed a, Fixed b) { return a.raw <= b.raw; }
+    friend bool operator>(Fixed a, Fixed b) { return a.raw > b.raw; }
+    friend bool operator>=(Fixed a, Fixed b) { return a.raw >= b.raw; }
 };
 
-// Class to represent the helicopter
-class Helicopter
+// Type of entity positions and velocities. -DFIXED_POINT=16 selects 16.16 in
+// int32, -DFIXED_POINT=8 selects 8.8 in int16.
+#if !defined(FIXED_POINT)
+typedef double Coord;
+#elif FIXED_POINT == 16
+typedef Fixed<int32_t, 16> Coord;
+#elif FIXED_POINT == 8
+typedef Fixed<int16_t, 8> Coord;
+#else
+#error "FIXED_POINT must be 8 or 16"
+#endif
+
+// Grid cell containing a coordinate
+inline int cell(double v)
 {
-public:
-    double x;
-    double y;
-    int remaining_missiles;
-    pthread_mutex_t mtx_remaining_missiles;
-    pthread_mutex_t mtx;
-    int last_horizontal_direction; // -1 for left, 1 for right
+    return static_cast<int>(v);
+}
 
-    Helicopter(int startX, int startY, int capacity)
-        : x(startX), y(startY), remaining_missiles(capacity),
-          last_horizontal_direction(1)
+template <class Rep, int FracBits>
+inline int cell(Fixed<Rep, FracBits> v)
+{
+    return v.cell();
+}
+
+inline double to_double(double v)
+{
+    return v;
+}
+
+template <class Rep, int FracBits>
+inline double to_double(Fixed<Rep, FracBits> v)
+{
+    return v.to_double();
+}
+
+// Initial move count for observers of the helicopter, so moves made before
+// they existed are not swept against them
+const unsigned long NO_MOVES_SEEN = ~0UL;
+
+// Grid cells covered by an entity while moving between two positions
+struct SweptBox
+{
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+};
+
+SweptBox sweep(Coord from_x, Coord from_y, Coord to_x, Coord to_y)
+{
+    int fx = cell(from_x);
+    int fy = cell(from_y);
+    int tx = cell(to_x);
+    int ty = cell(to_y);
+    SweptBox box = {std::min(fx, tx), std::min(fy, ty), std::max(fx, tx), std::max(fy, ty)};
+    return box;
+}
+
+// Two movements can only have met if their swept boxes share a cell
+bool overlaps(const SweptBox &a, const SweptBox &b)
+{
+    return a.min_x <= b.max_x && b.min_x <= a.max_x &&
+           a.min_y <= b.max_y && b.min_y <= a.max_y;
+}
+
+// Monotonic time (in microseconds)
+long long now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Fraction of a tick elapsed since an entity's last step, clamped to [0, 1]
+double interpolation_alpha(long long now, long long step_time, int tick)
+{
+    double alpha = static_cast<double>(now - step_time) / tick;
+    return std::max(0.0, std::min(1.0, alpha));
+}
+
+// Cell to draw a coordinate at, 'alpha' of the way from its previous simulated
+// value to its current one
+int interpolated_cell(Coord from, Coord to, double alpha)
+{
+    return static_cast<int>(to_double(from) + (to_double(to) - to_double(from)) * alpha);
+}
+
+// Ways of shedding work when loops overrun, in the order they are applied
+enum Degradation
+{
+    DEGRADE_NONE,
+    DEGRADE_SKIP_FRAMES,      // Draw every other render frame
+    DEGRADE_THROTTLE_DISTANT, // Step entities far from the helicopter two ticks at a time
+    DEGRADE_THROTTLE_ALL,     // Step everything two ticks at a time
+    DEGRADATION_LEVELS
+};
+
+const int BUDGET_WINDOW_US = 250000; // How often the overrun ratio is looked at
+const int BUDGET_CALM_WINDOWS = 4;   // Windows without overruns before shedding less
+
+// Watchdog over the period of every loop. Overruns are counted per window;
+// a window with more than 10% of frames late sheds the next kind of work,
+// and a run of windows without any gives it back. Every entity loop reports
+// to it, so frames are only counted with atomics; the one loop that notices
+// the window is over takes the mutex to move the level.
+class FrameBudget
+{
+public:
+    pthread_mutex_t mtx;
+    std::atomic<int> level; // Current Degradation
+    std::atomic<long long> window_start;
+    std::atomic<int> window_frames;
+    std::atomic<int> window_overruns;
+    int calm_windows;  // Only touched under mtx
+    bool skipped_last; // Whether the last render frame was skipped; only touched by the render loop
+
+    // Metrics
+    std::atomic<unsigned long> overruns;
+    unsigned long degradations[DEGRADATION_LEVELS]; // Times each level was entered; only touched under mtx
+    unsigned long recoveries;                       // Times a level was given back; only touched under mtx
+    std::atomic<unsigned long> skipped_frames;
+    std::atomic<unsigned long> throttled_steps; // Steps that covered more than one tick
+
+    FrameBudget()
+        : level(DEGRADE_NONE), window_start(now_us()), window_frames(0), window_overruns(0), calm_windows(0),
+          skipped_last(false), overruns(0), recoveries(0), skipped_frames(0), throttled_steps(0)
     {
-        pthread_mutex_init(&mtx_remaining_missiles, nullptr);
+        std::fill(degradations, degradations + DEGRADATION_LEVELS, 0);
         pthread_mutex_init(&mtx, nullptr);
     }
 
-    ~Helicopter()
+    ~FrameBudget()
     {
-        pthread_mutex_destroy(&mtx_remaining_missiles);
         pthread_mutex_destroy(&mtx);
     }
 
-    int get_remaining_missiles()
+    int get_level()
     {
-        pthread_mutex_lock(&mtx_remaining_missiles);
-        int value = remaining_missiles;
-        pthread_mutex_unlock(&mtx_remaining_missiles);
-        return value;
+        return level.load(std::memory_order_relaxed);
     }
 
-    void move(double dx, double dy)
+    // A loop finished a frame, late or not
+    void report(bool overrun)
     {
-        pthread_mutex_lock(&mtx);
-        x += dx;
-        y += dy;
-        pthread_mutex_unlock(&mtx);
+        window_frames.fetch_add(1, std::memory_order_relaxed);
+        if (overrun)
+        {
+            window_overruns.fetch_add(1, std::memory_order_relaxed);
+            overruns.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        long long now = now_us();
+        long long start = window_start.load(std::memory_order_relaxed);
+        if (now - start >= BUDGET_WINDOW_US && window_start.compare_exchange_strong(start, now))
+            roll_window();
     }
 
-    double get_x()
+    // Whether the render loop should leave this frame out
+    bool skip_frame()
     {
-        pthread_mutex_lock(&mtx);
-        double value = x;
+        bool skip = get_level() >= DEGRADE_SKIP_FRAMES && !skipped_last;
+        skipped_last = skip;
+        if (skip)
+            skipped_frames.fetch_add(1, std::memory_order_relaxed);
+        return skip;
+    }
+
+    // How many ticks an entity should cover with its next step
+    int ticks_per_step(bool distant)
+    {
+        int current = get_level();
+        int ticks = 1;
+        if (distant && current >= DEGRADE_THROTTLE_DISTANT)
+            ticks *= 2;
+        if (current >= DEGRADE_THROTTLE_ALL)
+            ticks *= 2;
+        if (ticks > 1)
+            throttled_steps.fetch_add(1, std::memory_order_relaxed);
+        return ticks;
+    }
+
+private:
+    // Move the level for the window that just ended. Only the loop that won
+    // the window_start exchange gets here, once per window.
+    void roll_window()
+    {
+        int frames = window_frames.exchange(0);
+        int late = window_overruns.exchange(0);
+
+        TRACED_LOCK(mtx);
+        int current = level.load(std::memory_order_relaxed);
+        if (late * 10 > frames)
+        {
+            calm_windows = 0;
+            if (current < DEGRADE_THROTTLE_ALL)
+            {
+                level.store(current + 1, std::memory_order_relaxed);
+                degradations[current + 1]++;
+            }
+        }
+        else if (late == 0 && current > DEGRADE_NONE && ++calm_windows >= BUDGET_CALM_WINDOWS)
+        {
+            calm_windows = 0;
+            level.store(current - 1, std::memory_order_relaxed);
+            recoveries++;
+        }
         pthread_mutex_unlock(&mtx);
-        return value;
+    }
+};
+
+FrameBudget frame_budget;
+
+// Keeps a loop on a fixed period measured from when each frame was due,
+// not from when the last sleep ended, and reports overruns to the budget.
+// A loop that falls behind starts over from now instead of catching up.
+class FrameClock
+{
+public:
+    long long next; // When the current frame was due
+
+    FrameClock() : next(now_us()) {}
+
+    // The current frame took 'period' of the schedule; returns how long to
+    // sleep until the next one
+    int frame_done(int period)
+    {
+        next += period;
+        long long now = now_us();
+        bool overrun = now > next;
+        frame_budget.report(overrun);
+        if (overrun)
+        {
+            next = now;
+            return 0;
+        }
+        return static_cast<int>(next - now);
+    }
+};
+
+bool far_from_helicopter(Coord x);
+
+#ifdef COROUTINES
+// Entity behaviors can run as C++20 coroutines on one scheduler thread instead
+// of a thread each (-DCOROUTINES, needs -std=c++20). A behavior co_awaits
+// sim_sleep(); the scheduler resumes it when due.
+std::atomic<unsigned long> behavior_frames(0);
+std::atomic<unsigned long> behavior_frame_bytes(0);
+
+struct Behavior
+{
+    struct promise_type
+    {
+        void (*on_done)(void *) = nullptr; // Called with 'owner' once the frame is destroyed
+        void *owner = nullptr;
+
+        // Counted so the benchmark can report frame sizes
+        static void *operator new(size_t size)
+        {
+            behavior_frames++;
+            behavior_frame_bytes += size;
+            return ::operator new(size);
+        }
+
+        static void operator delete(void *p)
+        {
+            ::operator delete(p);
+        }
+
+        Behavior get_return_object()
+        {
+            return Behavior{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+typedef std::coroutine_handle<Behavior::promise_type> BehaviorHandle;
+
+// Cooperative scheduler resuming behaviors from a single thread
+class Scheduler
+{
+public:
+    Scheduler() : stopped(false), woken(false), resumes(0)
+    {
+        pthread_mutex_init(&mtx, nullptr);
+        init_wait_cond(&cv);
+    }
+
+    ~Scheduler()
+    {
+        pthread_mutex_destroy(&mtx);
+        pthread_cond_destroy(&cv);
     }
 
-    double get_y()
+    // Queue a new behavior; on_done(owner) runs once it has finished
+    void spawn(Behavior behavior, void (*on_done)(void *), void *owner)
     {
+        behavior.handle.promise().on_done = on_done;
+        behavior.handle.promise().owner = owner;
+
         pthread_mutex_lock(&mtx);
-        double value = y;
+        if (stopped)
+        {
+            pthread_mutex_unlock(&mtx);
+            finish(behavior.handle);
+            return;
+        }
+        ready.push_back(behavior.handle);
+        pthread_cond_signal(&cv);
         pthread_mutex_unlock(&mtx);
-        return value;
     }
 
-    void set_x(double new_x)
+    void add_timer(long long wake_us, const bool *alive, BehaviorHandle handle)
     {
+        Timer timer = {wake_us, alive, handle};
         pthread_mutex_lock(&mtx);
-        x = new_x;
+        timers.push_back(timer);
+        std::push_heap(timers.begin(), timers.end(), later);
         pthread_mutex_unlock(&mtx);
     }
 
-    void set_y(double new_y)
+    // The game stopped or an entity was deactivated
+    void wake()
     {
         pthread_mutex_lock(&mtx);
-        y = new_y;
+        woken = true;
+        pthread_cond_signal(&cv);
         pthread_mutex_unlock(&mtx);
     }
 
-    bool can_fire()
+    unsigned long resume_count()
     {
-        pthread_mutex_lock(&mtx_remaining_missiles);
-        bool result = remaining_missiles > 0;
-        pthread_mutex_unlock(&mtx_remaining_missiles);
-        return result;
+        return resumes;
     }
 
-    void fire()
+    // Resume behaviors as they become due until the game stops, then destroy
+    // whatever is still suspended
+    void run()
     {
-        pthread_mutex_lock(&mtx_remaining_missiles);
-        if (remaining_missiles > 0)
+        pthread_mutex_lock(&mtx);
+        stopped = false;
+        pthread_mutex_unlock(&mtx);
+
+        std::vector<BehaviorHandle> due;
+        while (is_running())
         {
-            remaining_missiles--;
+            pthread_mutex_lock(&mtx);
+            due.swap(ready);
+            long long now = now_us();
+            while (!timers.empty() && timers.front().wake_us <= now)
+            {
+                std::pop_heap(timers.begin(), timers.end(), later);
+                due.push_back(timers.back().handle);
+                timers.pop_back();
+            }
+            if (woken)
+            {
+                // Resume deactivated entities early so they can finish
+                woken = false;
+                take_dead(timers, due);
+                std::make_heap(timers.begin(), timers.end(), later);
+            }
+            pthread_mutex_unlock(&mtx);
+
+            for (BehaviorHandle handle : due)
+            {
+                handle.resume();
+                resumes++;
+                if (handle.done())
+                    finish(handle);
+            }
+            due.clear();
+
+            pthread_mutex_lock(&mtx);
+            if (ready.empty() && !woken)
+            {
+                long long wait = timers.empty() ? 100000 : timers.front().wake_us - now_us();
+                if (wait > 0)
+                {
+                    timespec deadline = deadline_after(wait);
+                    pthread_cond_timedwait(&cv, &mtx, &deadline);
+                }
+            }
+            pthread_mutex_unlock(&mtx);
         }
-        pthread_mutex_unlock(&mtx_remaining_missiles);
+
+        pthread_mutex_lock(&mtx);
+        stopped = true;
+        due.swap(ready);
+        for (const Timer &timer : timers)
+            due.push_back(timer.handle);
+        timers.clear();
+        pthread_mutex_unlock(&mtx);
+
+        for (BehaviorHandle handle : due)
+            finish(handle);
     }
 
-    void reload(int amount)
+private:
+    struct Timer
     {
-        pthread_mutex_lock(&mtx_remaining_missiles);
-        remaining_missiles += amount;
-        pthread_mutex_unlock(&mtx_remaining_missiles);
+        long long wake_us;
+        const bool *alive;
+        BehaviorHandle handle;
+    };
+
+    static bool later(const Timer &a, const Timer &b)
+    {
+        return a.wake_us > b.wake_us;
     }
 
-    void set_last_horizontal_direction(int dir)
+    static void take_dead(std::vector<Timer> &waiting, std::vector<BehaviorHandle> &due)
     {
-        pthread_mutex_lock(&mtx);
-        last_horizontal_direction = dir;
-        pthread_mutex_unlock(&mtx);
+        for (auto it = waiting.begin(); it != waiting.end();)
+        {
+            if (!*it->alive)
+            {
+                due.push_back(it->handle);
+                it = waiting.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
     }
 
-    int get_last_horizontal_direction()
+    static void finish(BehaviorHandle handle)
     {
-        pthread_mutex_lock(&mtx);
-        int value = last_horizontal_direction;
-        pthread_mutex_unlock(&mtx);
-        return value;
+        void (*on_done)(void *) = handle.promise().on_done;
+        void *owner = handle.promise().owner;
+        handle.destroy();
+        if (on_done)
+            on_done(owner);
     }
 
-    void reload_from_depot();
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    bool stopped;
+    bool woken;
+    std::atomic<unsigned long> resumes;
+    std::vector<BehaviorHandle> ready;
+    std::vector<Timer> timers; // Min-heap on wake_us
 };
 
-// Global instances
-Helicopter heli(WIDTH / 2, HEIGHT / 2, n);
-Depot depot(n);
+Scheduler scheduler;
 
-// Class to represent the truck
-class Truck
+void wake_scheduler()
+{
+    scheduler.wake();
+}
+
+void *thread_scheduler(void *arg)
+{
+    TRACE_THREAD("thread_scheduler");
+    EVENT_LOG_THREAD();
+    scheduler.run();
+    return nullptr;
+}
+
+// co_await sim_sleep(usec, &active): resume after 'usec' of sim time, or
+// earlier once '*alive' turns false
+struct SimSleep
+{
+    long long wake_us;
+    const bool *alive;
+
+    bool await_ready() const { return false; }
+    void await_suspend(BehaviorHandle handle) const { scheduler.add_timer(wake_us, alive, handle); }
+    void await_resume() const {}
+};
+
+SimSleep sim_sleep(int usec, const bool *alive)
+{
+    SimSleep awaiter = {now_us() + usec, alive};
+    return awaiter;
+}
+
+// Drop one reference to an entity, deleting it with the last one. Its list and
+// its running behavior each hold one, so neither has to wait for the other.
+template <class T>
+void release_entity(void *p)
+{
+    T *entity = static_cast<T *>(p);
+    if (entity->refs.fetch_sub(1) == 1)
+        delete entity;
+}
+#endif
+
+// Free an entity that has been taken out of its list
+template <class T>
+void retire(T *entity)
+{
+#ifdef COROUTINES
+    release_entity<T>(entity);
+#else
+    entity->join();
+    delete entity;
+#endif
+}
+
+// Class to represent a missile
+template <class C>
+class BasicMissile
 {
 public:
-    double x;
-    double y;
-    double target_x;
-    double speed;
+    Coord x;
+    Coord y;
+    Coord prev_x;        // Position before the last step
+    long long step_time; // When the last step happened, for interpolated drawing
+    int step_period;     // Time the last step covers
+    int direction;       // -1 for left, 1 for right
     bool active;
     pthread_t th;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv; // Signalled when this entity is stopped or the game ends
+#ifdef COROUTINES
+    std::atomic<int> refs{1}; // See release_entity()
+#endif
+
+    BasicMissile(Coord startX, Coord startY, int dir)
+        : x(startX), y(startY), prev_x(startX), step_time(now_us()), step_period(C::sim_tick()),
+          direction(dir), active(true), th(0)
+    {
+        pthread_mutex_init(&mtx, nullptr);
+        init_wait_cond(&cv);
+    }
 
-    Truck(double startX, double startY, double targetX, double spd)
-        : x(startX), y(startY), target_x(targetX),
-          speed(spd), active(true), th(0) {}
+    ~BasicMissile()
+    {
+        pthread_cond_destroy(&cv);
+        pthread_mutex_destroy(&mtx);
+    }
 
     static void *move_wrapper(void *arg)
     {
-        Truck *truck = static_cast<Truck *>(arg);
-        truck->move();
+        TRACE_THREAD("missile");
+        EVENT_LOG_THREAD();
+        BasicMissile *m = static_cast<BasicMissile *>(arg);
+        m->move();
         return nullptr;
     }
 
     void start()
     {
-        pthread_create(&th, nullptr, Truck::move_wrapper, this);
+#ifdef COROUTINES
+        refs++;
+        scheduler.spawn(behavior(), &release_entity<BasicMissile>, this);
+#else
+        pthread_create(&th, nullptr, BasicMissile::move_wrapper, this);
+#endif
+    }
+
+    // Advance 'ticks' ticks; returns false once the missile has left the screen or hit something
+    bool step(int ticks = 1)
+    {
+        TRACE_SCOPE("Missile::step");
+        if (!(active && x > 1 && x < C::width() - 2))
+        {
+            active = false;
+            return false;
+        }
+        pthread_mutex_lock(&mtx);
+        advance(ticks);
+        step_time = now_us();
+        step_period = ticks * C::sim_tick();
+        pthread_mutex_unlock(&mtx);
+        check_collision();
+        return true;
+    }
+
+    // The motion of a step on its own; caller holds mtx or owns the missile
+    void advance(int ticks)
+    {
+        prev_x = x;
+        x += ticks * direction * Coord(C::missile_speed() * sim_dt<C>());
     }
 
     void move()
     {
-        // Move towards the depot
-        while (active && x < target_x)
+        FrameClock clock;
+        int ticks = 1;
+        while (step(ticks))
         {
-            x += speed;
-            usleep(500000);
+            if (!sleep_while_alive(clock.frame_done(ticks * C::sim_tick()), &mtx, &cv, &active))
+                break;
+            ticks = frame_budget.ticks_per_step(far_from_helicopter(x));
         }
+    }
 
-        // Unload missiles
-        if (active)
+#ifdef COROUTINES
+    Behavior behavior()
+    {
+        FrameClock clock;
+        int ticks = 1;
+        while (step(ticks))
         {
-            depot.truck_unload(n);
-            usleep(2000000);
+            co_await sim_sleep(clock.frame_done(ticks * C::sim_tick()), &active);
+            ticks = frame_budget.ticks_per_step(far_from_helicopter(x));
         }
+    }
+#endif
 
-        // Exit the screen
-        double exit_x = WIDTH;
-        while (active && x < exit_x)
+    void draw(long long now)
+    {
+        if (active)
         {
-            x += speed;
-            usleep(500000);
+            pthread_mutex_lock(&mtx);
+            int draw_x = interpolated_cell(prev_x, x, interpolation_alpha(now, step_time, step_period));
+            pthread_mutex_unlock(&mtx);
+
+            char missile_char = (direction == 1) ? '>' : '<';
+            mvprintw(cell(y), draw_x, "%c", missile_char);
         }
+    }
 
+    // Deactivate from another thread, waking only this entity's sleep
+    void stop()
+    {
+        pthread_mutex_lock(&mtx);
         active = false;
+        pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mtx);
+#ifdef COROUTINES
+        wake_scheduler();
+#endif
+    }
+
+    // Cut the current sleep short so it sees the game has stopped
+    void wake()
+    {
+        pthread_mutex_lock(&mtx);
+        pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mtx);
     }
 
     void join()
@@ -454,458 +1440,2451 @@ public:
         }
     }
 
-    void draw()
-    {
-        if (active)
-        {
-            mvprintw(static_cast<int>(y), static_cast<int>(x), "T");
-        }
-    }
+    void check_collision();
 };
 
-// Function declarations
-void *thread_input(void *arg);
-void *thread_render(void *arg);
-void *thread_dinosaur_manager(void *arg);
-void *thread_truck(void *arg);
-
-// Methods relying on 'depot'
-void Helicopter::reload_from_depot()
-{
-    depot.helicopter_reload(n - heli.get_remaining_missiles());
-}
-
-// Implement Depot methods
-void Depot::truck_unload(int amount)
+#ifdef CHASE_MODE
+// Distance field towards the helicopter, shared by every chasing dinosaur
+// (-DCHASE_MODE). It is rebuilt with one breadth-first search when the
+// helicopter enters a new cell, and stores the step to take from each cell,
+// so a dinosaur only reads its own cell however many of them are chasing.
+class FlowField
 {
-    pthread_mutex_lock(&mtx);
-    while (!(missiles < capacity && !is_helicopter_reloading))
+public:
+    pthread_rwlock_t lock;
+    int width;
+    int height;
+    int target; // Cell of the helicopter, -1 until the first build
+    std::vector<char> open; // Cells a dinosaur can be in
+    std::vector<int> distance;
+    std::vector<signed char> step_x;
+    std::vector<signed char> step_y;
+    std::vector<int> frontier;
+    unsigned long rebuilds;
+    double rebuild_seconds;
+
+    FlowField() : width(0), height(0), target(-1), rebuilds(0), rebuild_seconds(0)
     {
-        pthread_cond_wait(&cv_truck, &mtx);
+        pthread_rwlock_init(&lock, nullptr);
     }
 
-    is_truck_unloading = true;
-    int unload_amount = std::min(amount, capacity - missiles);
-    missiles += unload_amount;
-    is_truck_unloading = false;
+    ~FlowField()
+    {
+        pthread_rwlock_destroy(&lock);
+    }
 
-    pthread_cond_broadcast(&cv_helicopter);
-    pthread_mutex_unlock(&mtx);
+    // Point the field at the helicopter's cell, rebuilding it if that changed
+    void retarget(int target_x, int target_y)
+    {
+        pthread_rwlock_wrlock(&lock);
+        if (width != Config::width() || height != Config::height())
+        {
+            width = Config::width();
+            height = Config::height();
+            distance.assign(width * height, UNREACHABLE);
+            step_x.assign(width * height, 0);
+            step_y.assign(width * height, 0);
+            open.assign(width * height, 0);
+            for (int y = 0; y < height; y++)
+                for (int x = 0; x < width; x++)
+                    open[y * width + x] = walkable(x, y);
+            target = -1;
+        }
+
+        if (walkable(target_x, target_y) && target_y * width + target_x != target)
+        {
+            target = target_y * width + target_x;
+            rebuild();
+        }
+        pthread_rwlock_unlock(&lock);
+    }
+
+    // Step to take from a cell; dx and dy are left alone if there is no way
+    void flow(int cell_x, int cell_y, int &dx, int &dy)
+    {
+        pthread_rwlock_rdlock(&lock);
+        if (target >= 0 && cell_x >= 0 && cell_x < width && cell_y >= 0 && cell_y < height)
+        {
+            int i = cell_y * width + cell_x;
+            if (distance[i] != UNREACHABLE)
+            {
+                dx = step_x[i];
+                dy = step_y[i];
+            }
+        }
+        pthread_rwlock_unlock(&lock);
+    }
+
+private:
+    enum { UNREACHABLE = -1 };
+
+    // Inside the border and not the depot, which dinosaurs have to jump over
+    bool walkable(int x, int y) const
+    {
+        return x >= 1 && x <= width - 2 && y >= 1 && y <= height - 2 &&
+               !(x == Config::depot_x() && y == Config::depot_y());
+    }
+
+    void rebuild()
+    {
+        // Neighbours on the same row first, then down, then up, and diagonals
+        // before straight down or up: ties keep dinosaurs on the ground and
+        // moving sideways, since they can only jump so high
+        static const int dxs[8] = {-1, 1, -1, 1, 0, -1, 1, 0};
+        static const int dys[8] = {0, 0, 1, 1, 1, -1, -1, -1};
+        int offsets[8];
+        for (int k = 0; k < 8; k++)
+            offsets[k] = dys[k] * width + dxs[k];
+
+        // The border is closed, so neighbours of open cells stay on the grid
+        auto start = std::chrono::steady_clock::now();
+        std::fill(distance.begin(), distance.end(), UNREACHABLE);
+        frontier.clear();
+        distance[target] = 0;
+        frontier.push_back(target);
+        for (size_t head = 0; head < frontier.size(); head++)
+        {
+            int i = frontier[head];
+            for (int k = 0; k < 8; k++)
+            {
+                int n = i + offsets[k];
+                if (open[n] && distance[n] == UNREACHABLE)
+                {
+                    distance[n] = distance[i] + 1;
+                    frontier.push_back(n);
+                }
+            }
+        }
+
+        // Every reached cell steps to its closest neighbour
+        for (int i : frontier)
+        {
+            int best = distance[i];
+            step_x[i] = 0;
+            step_y[i] = 0;
+            for (int k = 0; k < 8; k++)
+            {
+                int n = i + offsets[k];
+                if (open[n] && distance[n] < best)
+                {
+                    best = distance[n];
+                    step_x[i] = dxs[k];
+                    step_y[i] = dys[k];
+                }
+            }
+        }
+        rebuilds++;
+        rebuild_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+FlowField flow_field;
+#endif
+
+// Class to represent a dinosaur
+template <class C>
+class BasicDinosaur
+{
+public:
+    Coord x;
+    Coord y;
+    Coord prev_x; // Position before the last step, used for swept collision
+    Coord prev_y;
+    int prev_direction;
+    long long step_time;           // When the last step happened, for interpolated drawing
+    int step_period;               // Time the last step covers
+    unsigned long seen_heli_moves; // Helicopter move count at the last collision check, NO_MOVES_SEEN before the first
+    int health;
+    bool active;
+    pthread_t th;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv; // Signalled when this entity is stopped or the game ends
+#ifdef COROUTINES
+    std::atomic<int> refs{1}; // See release_entity()
+#endif
+    int direction; // 1 for right, -1 for left
+
+    // Jumping variables
+    bool is_jumping;
+    Coord vertical_velocity; // In cells per tick
+
+    BasicDinosaur(Coord startX, Coord startY, int initial_health, int initial_direction = -1)
+        : x(startX), y(startY), prev_x(startX), prev_y(startY), prev_direction(initial_direction),
+          step_time(now_us()), step_period(C::sim_tick()), seen_heli_moves(NO_MOVES_SEEN),
+          health(initial_health), active(true), th(0),
+          direction(initial_direction), is_jumping(false), vertical_velocity(0)
+    {
+        pthread_mutex_init(&mtx, nullptr);
+        init_wait_cond(&cv);
+    }
+
+    ~BasicDinosaur()
+    {
+        pthread_cond_destroy(&cv);
+        pthread_mutex_destroy(&mtx);
+    }
+
+    static void *move_wrapper(void *arg)
+    {
+        TRACE_THREAD("dinosaur");
+        EVENT_LOG_THREAD();
+        BasicDinosaur *d = static_cast<BasicDinosaur *>(arg);
+        d->move();
+        return nullptr;
+    }
+
+    void start()
+    {
+#ifdef COROUTINES
+        refs++;
+        scheduler.spawn(behavior(), &release_entity<BasicDinosaur>, this);
+#else
+        pthread_create(&th, nullptr, BasicDinosaur::move_wrapper, this);
+#endif
+    }
+
+    // Advance 'ticks' ticks, checking collisions once over all of them
+    void step(int ticks = 1)
+    {
+        TRACE_SCOPE("Dinosaur::step");
+        pthread_mutex_lock(&mtx);
+        advance(ticks);
+        step_time = now_us();
+        step_period = ticks * C::sim_tick();
+        pthread_mutex_unlock(&mtx);
+
+        check_collision();
+    }
+
+    // The motion of a step on its own; caller holds mtx or owns the dinosaur
+    void advance(int ticks)
+    {
+        prev_x = x;
+        prev_y = y;
+        prev_direction = direction;
+
+        for (int tick = 0; tick < ticks; tick++)
+        {
+#ifdef CHASE_MODE
+            // Follow the shared flow field towards the helicopter
+            int step_x = direction;
+            int step_y = 0;
+            flow_field.flow(cell(x), cell(y), step_x, step_y);
+            if (step_x != 0)
+                direction = step_x;
+            x += step_x * Coord(C::dinosaur_speed() * sim_dt<C>());
+#else
+            x += direction * Coord(C::dinosaur_speed() * sim_dt<C>());
+#endif
+
+            // Change direction at boundaries
+            if (x <= 1)
+            {
+                x = 1;
+                direction = 1;
+            }
+            else if (x >= C::width() - 2)
+            {
+                x = C::width() - 2;
+                direction = -1;
+            }
+
+            // Handle vertical movement
+            if (is_jumping)
+            {
+                vertical_velocity += Coord(C::gravity() * sim_dt<C>() * sim_dt<C>());
+                y += vertical_velocity;
+
+                if (y >= C::height() - 2)
+                {
+                    y = C::height() - 2;
+                    is_jumping = false;
+                    vertical_velocity = 0;
+                }
+            }
+            else
+            {
+                y = C::height() - 2;
+
+#ifdef CHASE_MODE
+                // Jump when the way to the helicopter leads up
+                if (step_y < 0)
+#else
+                // Random chance to start a jump
+                if (rand() % 1000 < C::jump_rate() * sim_dt<C>() * 1000)
+#endif
+                {
+                    is_jumping = true;
+                    vertical_velocity = Coord(C::jump_strength() * sim_dt<C>());
+                }
+            }
+        }
+    }
+
+    void move()
+    {
+        FrameClock clock;
+        int ticks = 1;
+        while (active)
+        {
+            step(ticks);
+            if (!sleep_while_alive(clock.frame_done(ticks * C::sim_tick()), &mtx, &cv, &active))
+                break;
+            ticks = frame_budget.ticks_per_step(far_from_helicopter(x));
+        }
+    }
+
+#ifdef COROUTINES
+    Behavior behavior()
+    {
+        FrameClock clock;
+        int ticks = 1;
+        while (active)
+        {
+            step(ticks);
+            co_await sim_sleep(clock.frame_done(ticks * C::sim_tick()), &active);
+            ticks = frame_budget.ticks_per_step(far_from_helicopter(x));
+        }
+    }
+#endif
+
+    void draw(long long now)
+    {
+        if (active)
+        {
+            pthread_mutex_lock(&mtx);
+            double alpha = interpolation_alpha(now, step_time, step_period);
+            int draw_x = interpolated_cell(prev_x, x, alpha);
+            int draw_y = interpolated_cell(prev_y, y, alpha);
+            pthread_mutex_unlock(&mtx);
+
+            mvprintw(draw_y, draw_x, "D"); // Dinosaur body
+            int head_x = draw_x + direction;
+            mvprintw(draw_y - 1, head_x, "O"); // Dinosaur head
+        }
+    }
+
+    // Deactivate from another thread, waking only this entity's sleep
+    void stop()
+    {
+        pthread_mutex_lock(&mtx);
+        active = false;
+        pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mtx);
+#ifdef COROUTINES
+        wake_scheduler();
+#endif
+    }
+
+    // Cut the current sleep short so it sees the game has stopped
+    void wake()
+    {
+        pthread_mutex_lock(&mtx);
+        pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void join()
+    {
+        if (th)
+        {
+            pthread_join(th, nullptr);
+            th = 0;
+        }
+    }
+
+    void take_damage()
+    {
+        pthread_mutex_lock(&mtx);
+        health--;
+        bool killed = health <= 0;
+        if (killed)
+        {
+            active = false;
+            pthread_cond_signal(&cv);
+            LOG_EVENT(EVENT_DINOSAUR_KILLED, cell(x), cell(y), 0);
+        }
+        pthread_mutex_unlock(&mtx);
+
+#ifdef COROUTINES
+        if (killed)
+            wake_scheduler();
+#endif
+    }
+
+    // Cells covered by the body (including jump arcs) and by the head during
+    // the last step, read together so both come from the same step
+    void swept_boxes(SweptBox &body, SweptBox &head)
+    {
+        pthread_mutex_lock(&mtx);
+        swept_boxes_unlocked(body, head);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void swept_boxes_unlocked(SweptBox &body, SweptBox &head)
+    {
+        body = sweep(prev_x, prev_y, x, y);
+        head = sweep(prev_x + prev_direction, prev_y - 1, x + direction, y - 1);
+    }
+
+    void check_collision();
+};
+
+// Class to represent the depot
+class Depot
+{
+public:
+    int capacity; // Total capacity (n slots)
+    int missiles; // Current number of missiles
+    pthread_mutex_t mtx;
+
+    // Consumption and starvation statistics, guarded by mtx
+    long long start_time;   // When the statistics started
+    long consumed;          // Missiles taken by the helicopter
+    long long empty_since;  // When the depot last ran dry, 0 while stocked
+    long long starved_time; // Total time spent empty (in microseconds)
+    int starvations;        // Number of times the depot ran dry
+
+    Depot(int capacity)
+        : capacity(capacity), missiles(capacity), start_time(now_us()), consumed(0), empty_since(0), starved_time(0),
+          starvations(0)
+    {
+        pthread_mutex_init(&mtx, nullptr);
+    }
+
+    ~Depot()
+    {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    int truck_unload(int amount);
+    int helicopter_reload(int amount);
+
+    int stock()
+    {
+        pthread_mutex_lock(&mtx);
+        int value = missiles;
+        pthread_mutex_unlock(&mtx);
+        return value;
+    }
+
+    // Average missiles taken by the helicopter per second
+    double consumption_rate()
+    {
+        pthread_mutex_lock(&mtx);
+        double seconds = std::max(1.0, (now_us() - start_time) / 1e6);
+        double rate = consumed / seconds;
+        pthread_mutex_unlock(&mtx);
+        return rate;
+    }
+
+    // Average length of a period with the depot empty (in seconds), counting
+    // the current one
+    double average_starvation()
+    {
+        pthread_mutex_lock(&mtx);
+        long long total = starved_time;
+        int periods = starvations;
+        if (empty_since)
+            total += now_us() - empty_since;
+        pthread_mutex_unlock(&mtx);
+        return periods ? total / 1e6 / periods : 0;
+    }
+};
+
+// Moves the helicopter remembers for collision checks; observers check once a
+// tick, and a player cannot make this many moves in one
+const int HELI_MOVE_HISTORY = 64;
+
+// Class to represent the helicopter
+class Helicopter
+{
+public:
+    Coord x;
+    Coord y;
+    unsigned long moves; // Number of moves made so far
+    std::atomic<int> column; // Cell of x, for readers that must not take mtx every tick
+    SweptBox recent_moves[HELI_MOVE_HISTORY]; // Cell reached by move n, at n % HELI_MOVE_HISTORY
+    int remaining_missiles;
+    pthread_mutex_t mtx_remaining_missiles;
+    pthread_mutex_t mtx;
+    int last_horizontal_direction; // -1 for left, 1 for right
+
+    Helicopter(int startX, int startY, int capacity)
+        : x(startX), y(startY), moves(0), column(startX), remaining_missiles(capacity),
+          last_horizontal_direction(1)
+    {
+        pthread_mutex_init(&mtx_remaining_missiles, nullptr);
+        pthread_mutex_init(&mtx, nullptr);
+        moved_to(startX, startY);
+    }
+
+    ~Helicopter()
+    {
+        pthread_mutex_destroy(&mtx_remaining_missiles);
+        pthread_mutex_destroy(&mtx);
+    }
+
+    int get_remaining_missiles()
+    {
+        pthread_mutex_lock(&mtx_remaining_missiles);
+        int value = remaining_missiles;
+        pthread_mutex_unlock(&mtx_remaining_missiles);
+        return value;
+    }
+
+    void move(Coord dx, Coord dy)
+    {
+        pthread_mutex_lock(&mtx);
+        x += dx;
+        y += dy;
+        record_move();
+        int cell_x = cell(x);
+        int cell_y = cell(y);
+        pthread_mutex_unlock(&mtx);
+        moved_to(cell_x, cell_y);
+    }
+
+    Coord get_x()
+    {
+        pthread_mutex_lock(&mtx);
+        Coord value = x;
+        pthread_mutex_unlock(&mtx);
+        return value;
+    }
+
+    Coord get_y()
+    {
+        pthread_mutex_lock(&mtx);
+        Coord value = y;
+        pthread_mutex_unlock(&mtx);
+        return value;
+    }
+
+    void set_x(Coord new_x)
+    {
+        pthread_mutex_lock(&mtx);
+        x = new_x;
+        record_move();
+        int cell_x = cell(x);
+        int cell_y = cell(y);
+        pthread_mutex_unlock(&mtx);
+        moved_to(cell_x, cell_y);
+    }
+
+    void set_y(Coord new_y)
+    {
+        pthread_mutex_lock(&mtx);
+        y = new_y;
+        record_move();
+        int cell_x = cell(x);
+        int cell_y = cell(y);
+        pthread_mutex_unlock(&mtx);
+        moved_to(cell_x, cell_y);
+    }
+
+    bool can_fire()
+    {
+        pthread_mutex_lock(&mtx_remaining_missiles);
+        bool result = remaining_missiles > 0;
+        pthread_mutex_unlock(&mtx_remaining_missiles);
+        return result;
+    }
+
+    void fire()
+    {
+        pthread_mutex_lock(&mtx_remaining_missiles);
+        if (remaining_missiles > 0)
+        {
+            remaining_missiles--;
+        }
+        pthread_mutex_unlock(&mtx_remaining_missiles);
+    }
+
+    void reload(int amount)
+    {
+        pthread_mutex_lock(&mtx_remaining_missiles);
+        remaining_missiles += amount;
+        pthread_mutex_unlock(&mtx_remaining_missiles);
+    }
+
+    // Whether the helicopter met 'body' or 'head', an observer's swept boxes for
+    // its last step: the current cell and the cell reached by every move made
+    // since 'seen_moves' are each tested on their own, so no stop is missed and
+    // none is counted twice. The cells moves left from don't count, so moving
+    // out of a cell a dinosaur steps into during the same tick is a dodge.
+    bool met_since(unsigned long &seen_moves, const SweptBox &body, const SweptBox &head)
+    {
+        pthread_mutex_lock(&mtx);
+        SweptBox here = sweep(x, y, x, y);
+        bool met = overlaps(here, body) || overlaps(here, head);
+        if (seen_moves != NO_MOVES_SEEN)
+        {
+            unsigned long first = seen_moves + 1;
+            if (moves - seen_moves > static_cast<unsigned long>(HELI_MOVE_HISTORY))
+                first = moves - HELI_MOVE_HISTORY + 1;
+            for (unsigned long n = first; n <= moves && !met; n++)
+            {
+                const SweptBox &path = recent_moves[n % HELI_MOVE_HISTORY];
+                met = overlaps(path, body) || overlaps(path, head);
+            }
+        }
+        seen_moves = moves;
+        pthread_mutex_unlock(&mtx);
+        return met;
+    }
+
+    void set_last_horizontal_direction(int dir)
+    {
+        pthread_mutex_lock(&mtx);
+        last_horizontal_direction = dir;
+        pthread_mutex_unlock(&mtx);
+    }
+
+    int get_last_horizontal_direction()
+    {
+        pthread_mutex_lock(&mtx);
+        int value = last_horizontal_direction;
+        pthread_mutex_unlock(&mtx);
+        return value;
+    }
+
+    void reload_from_depot();
+
+private:
+    // Remember the cell the move just made reached; caller holds mtx
+    void record_move()
+    {
+        moves++;
+        recent_moves[moves % HELI_MOVE_HISTORY] = sweep(x, y, x, y);
+        column.store(cell(x), std::memory_order_relaxed);
+    }
+
+    // Keep the chasing dinosaurs' flow field pointed at the helicopter
+    void moved_to(int cell_x, int cell_y)
+    {
+#ifdef CHASE_MODE
+        flow_field.retarget(cell_x, cell_y);
+#endif
+    }
+};
+
+// Global instances
+Helicopter heli(Config::width() / 2, Config::height() / 2, Config::missile_capacity());
+Depot depot(Config::missile_capacity());
+
+// Entities this far from the helicopter are the first to be stepped less often
+bool far_from_helicopter(Coord x)
+{
+    return std::abs(cell(x) - heli.column.load(std::memory_order_relaxed)) > Config::width() / 4;
+}
+
+// A load the depot is expected to need, due by 'deadline' (in microseconds)
+struct DepotOrder
+{
+    long long deadline;
+    int amount;
+
+    // Earliest deadline on top of the priority queue
+    bool operator<(const DepotOrder &other) const { return deadline > other.deadline; }
+};
+
+// Class to send trucks where the depot demand is. Orders are replanned every
+// round from the depot stock and the helicopter's consumption rate, each with
+// the time a truck has to leave by; once that time comes, a truck leaves for
+// the most urgent due order while there are free trucks.
+class Dispatcher
+{
+public:
+    pthread_mutex_t mtx;
+    std::priority_queue<DepotOrder> orders;
+    int queued;     // Missiles in orders no truck has taken yet
+    int in_transit; // Missiles on trucks that have not reached the depot
+    int delivered;  // Trips that unloaded something
+    int wasted;     // Trips that found the depot full
+
+    Dispatcher() : queued(0), in_transit(0), delivered(0), wasted(0)
+    {
+        pthread_mutex_init(&mtx, nullptr);
+    }
+
+    ~Dispatcher()
+    {
+        pthread_mutex_destroy(&mtx);
+    }
+
+    void plan();
+    void dispatch();
+
+    // Called by a truck once it reaches the depot
+    void truck_arrived(int cargo, int unloaded)
+    {
+        LOG_EVENT(EVENT_TRUCK_ARRIVED, cargo, unloaded, 0);
+        pthread_mutex_lock(&mtx);
+        in_transit -= cargo;
+        if (unloaded > 0)
+            delivered++;
+        else
+            wasted++;
+        pthread_mutex_unlock(&mtx);
+    }
+};
+
+Dispatcher dispatcher;
+
+// Class to represent the truck
+template <class C>
+class BasicTruck
+{
+public:
+    Coord x;
+    Coord y;
+    Coord prev_x;        // Position before the last step
+    long long step_time; // When the last step happened, for interpolated drawing
+    Coord target_x;
+    Coord speed; // In cells per tick
+    int cargo;   // Missiles on board
+    bool active;
+    pthread_t th;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv; // Signalled when this entity is stopped or the game ends
+#ifdef COROUTINES
+    std::atomic<int> refs{1}; // See release_entity()
+#endif
+
+    BasicTruck(Coord startX, Coord startY, Coord targetX, Coord spd, int load)
+        : x(startX), y(startY), prev_x(startX), step_time(now_us()), target_x(targetX),
+          speed(spd), cargo(load), active(true), th(0)
+    {
+        pthread_mutex_init(&mtx, nullptr);
+        init_wait_cond(&cv);
+    }
+
+    ~BasicTruck()
+    {
+        pthread_cond_destroy(&cv);
+        pthread_mutex_destroy(&mtx);
+    }
+
+    static void *move_wrapper(void *arg)
+    {
+        TRACE_THREAD("truck");
+        EVENT_LOG_THREAD();
+        BasicTruck *truck = static_cast<BasicTruck *>(arg);
+        truck->move();
+        return nullptr;
+    }
+
+    void start()
+    {
+#ifdef COROUTINES
+        refs++;
+        scheduler.spawn(behavior(), &release_entity<BasicTruck>, this);
+#else
+        pthread_create(&th, nullptr, BasicTruck::move_wrapper, this);
+#endif
+    }
+
+    // Advance one tick
+    void step()
+    {
+        pthread_mutex_lock(&mtx);
+        prev_x = x;
+        x += speed;
+        step_time = now_us();
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void move()
+    {
+        // Move towards the depot
+        while (active && x < target_x)
+        {
+            step();
+            if (!sleep_while_alive(C::truck_tick(), &mtx, &cv, &active))
+                active = false;
+        }
+
+        // Unload missiles
+        if (active)
+        {
+            dispatcher.truck_arrived(cargo, depot.truck_unload(cargo));
+            if (!sleep_while_alive(C::truck_unload_time(), &mtx, &cv, &active))
+                active = false;
+        }
+
+        // Exit the screen
+        Coord exit_x = C::width();
+        while (active && x < exit_x)
+        {
+            step();
+            if (!sleep_while_alive(C::truck_tick(), &mtx, &cv, &active))
+                active = false;
+        }
+
+        active = false;
+    }
+
+#ifdef COROUTINES
+    // Same script as move(), suspended instead of sleeping
+    Behavior behavior()
+    {
+        // Move towards the depot
+        while (active && x < target_x)
+        {
+            step();
+            co_await sim_sleep(C::truck_tick(), &active);
+        }
+
+        // Unload missiles
+        if (active)
+        {
+            dispatcher.truck_arrived(cargo, depot.truck_unload(cargo));
+            co_await sim_sleep(C::truck_unload_time(), &active);
+        }
+
+        // Exit the screen
+        Coord exit_x = C::width();
+        while (active && x < exit_x)
+        {
+            step();
+            co_await sim_sleep(C::truck_tick(), &active);
+        }
+
+        active = false;
+    }
+#endif
+
+    // Deactivate from another thread, waking only this entity's sleep
+    void stop()
+    {
+        pthread_mutex_lock(&mtx);
+        active = false;
+        pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mtx);
+#ifdef COROUTINES
+        wake_scheduler();
+#endif
+    }
+
+    // Cut the current sleep short so it sees the game has stopped
+    void wake()
+    {
+        pthread_mutex_lock(&mtx);
+        pthread_cond_signal(&cv);
+        pthread_mutex_unlock(&mtx);
+    }
+
+    void join()
+    {
+        if (th)
+        {
+            pthread_join(th, nullptr);
+            th = 0;
+        }
+    }
+
+    void draw(long long now)
+    {
+        if (active)
+        {
+            pthread_mutex_lock(&mtx);
+            int draw_x = interpolated_cell(prev_x, x, interpolation_alpha(now, step_time, C::truck_tick()));
+            pthread_mutex_unlock(&mtx);
+
+            mvprintw(cell(y), draw_x, "T");
+        }
+    }
+};
+
+// Function declarations
+void *thread_input(void *arg);
+void *thread_render(void *arg);
+void *thread_dinosaur_manager(void *arg);
+void *thread_truck(void *arg);
+
+// Methods relying on 'depot'
+void Helicopter::reload_from_depot()
+{
+    depot.helicopter_reload(Config::missile_capacity() - heli.get_remaining_missiles());
+}
+
+// Implement Depot methods
+
+// Unload as much of 'amount' as fits and return how much that was. Trucks
+// never wait for room; the dispatcher only sends them when it expects some.
+int Depot::truck_unload(int amount)
+{
+    TRACE_SCOPE("Depot::truck_unload");
+    TRACED_LOCK(mtx);
+    int unload_amount = std::min(amount, capacity - missiles);
+    missiles += unload_amount;
+
+    if (unload_amount > 0 && empty_since)
+    {
+        starved_time += now_us() - empty_since;
+        empty_since = 0;
+    }
+    LOG_EVENT(EVENT_DEPOT_UNLOAD, unload_amount, missiles, 0);
+    pthread_mutex_unlock(&mtx);
+    return unload_amount;
+}
+
+// Take up to 'amount' missiles, whatever the depot has; never blocks, so the
+// input thread keeps reading keys while hovering over an empty depot
+int Depot::helicopter_reload(int amount)
+{
+    TRACE_SCOPE("Depot::helicopter_reload");
+    TRACED_LOCK(mtx);
+    if (missiles == 0)
+    {
+        pthread_mutex_unlock(&mtx);
+        return 0;
+    }
+
+    int reload_amount = std::min(amount, missiles);
+    missiles -= reload_amount;
+    heli.reload(reload_amount);
+
+    consumed += reload_amount;
+    if (missiles == 0 && !empty_since)
+    {
+        empty_since = now_us();
+        starvations++;
+    }
+    LOG_EVENT(EVENT_DEPOT_RELOAD, reload_amount, missiles, 0);
+    pthread_mutex_unlock(&mtx);
+    return reload_amount;
+}
+
+// Helper function to check if a position is occupied by an active dinosaur or the depot
+template <class C>
+bool is_position_occupied(Coord x, Coord y)
+{
+    TRACED_LOCK(mtx_dinosaurs);
+    for (const auto &d : dinosaurs)
+    {
+        if (d->active)
+        {
+            // Dinosaur body
+            if (cell(d->x) == cell(x) &&
+                cell(d->y) == cell(y))
+            {
+                pthread_mutex_unlock(&mtx_dinosaurs);
+                return true;
+            }
+            // Dinosaur head
+            int head_x = cell(d->x + d->direction);
+            if (head_x == cell(x) &&
+                cell(d->y - 1) == cell(y))
+            {
+                pthread_mutex_unlock(&mtx_dinosaurs);
+                return true;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mtx_dinosaurs);
+
+    // Depot position
+    if (cell(x) == C::depot_x() && cell(y) == C::depot_y())
+        return true;
+
+    return false;
+}
+
+// Function to manage the truck
+void *thread_truck(void *arg)
+{
+    TRACE_THREAD("thread_truck");
+    while (sleep_while_running(Config::truck_interval()))
+    {
+        dispatcher.plan();
+        dispatcher.dispatch();
+    }
+    return nullptr;
+}
+
+// Replan the orders for the room the depot is expected to have when a truck
+// leaving now would arrive. Orders no truck has taken yet are dropped and
+// planned again from the current stock and rate, so their deadlines never go
+// stale and undelivered orders are never counted as stock.
+void Dispatcher::plan()
+{
+    TRACE_SCOPE("Dispatcher::plan");
+    double rate = depot.consumption_rate(); // Missiles per second
+    int stock = depot.stock();
+    double travel_time = (Config::depot_x() - 2) / Config::truck_speed(); // In seconds
+    long long now = now_us();
+
+    pthread_mutex_lock(&mtx);
+    orders = std::priority_queue<DepotOrder>();
+    queued = 0;
+
+    // Round the missiles used on the way up, so the stock is never overestimated
+    int used_on_the_way = static_cast<int>(std::ceil(rate * travel_time));
+    int stock_at_arrival = std::max(0, stock - used_on_the_way);
+    int room = depot.capacity - stock_at_arrival - in_transit;
+    int covered = stock + in_transit;
+
+    // Leave in time to arrive before the covered stock runs out
+    double runs_out = rate > 0 ? covered / rate : 0;
+    long long deadline = now + static_cast<long long>((runs_out - travel_time) * 1e6);
+    while (room > 0)
+    {
+        DepotOrder order;
+        order.amount = std::min(Config::missile_capacity(), room);
+        order.deadline = deadline;
+        orders.push(order);
+        queued += order.amount;
+        room -= order.amount;
+    }
+    pthread_mutex_unlock(&mtx);
+}
+
+// Send a truck for each order whose deadline has come, most urgent first,
+// while trucks are free. Orders not yet due wait for a later round.
+void Dispatcher::dispatch()
+{
+    TRACE_SCOPE("Dispatcher::dispatch");
+    long long now = now_us();
+    TRACED_LOCK(mtx_trucks);
+    pthread_mutex_lock(&mtx);
+    while (!orders.empty() && orders.top().deadline <= now &&
+           static_cast<int>(active_trucks.size()) < Config::max_trucks())
+    {
+        DepotOrder order = orders.top();
+        orders.pop();
+        queued -= order.amount;
+        in_transit += order.amount;
+
+        Truck *truck = new Truck(1, Config::depot_y(), Config::depot_x() - 1,
+                                 Config::truck_speed() * Config::truck_tick() / 1e6, order.amount);
+        active_trucks.push_back(truck);
+        truck->start();
+    }
+    pthread_mutex_unlock(&mtx);
+    pthread_mutex_unlock(&mtx_trucks);
+}
+
+template <class C>
+bool is_near_depot(Coord heli_x, Coord heli_y)
+{
+    int dx = std::abs(cell(heli_x) - C::depot_x());
+    int dy = std::abs(cell(heli_y) - C::depot_y());
+    return (dx <= 1 && dy <= 1);
+}
+
+// Function to manage player input
+void *thread_input(void *arg)
+{
+    TRACE_THREAD("thread_input");
+    EVENT_LOG_THREAD();
+    int ch;
+    nodelay(stdscr, TRUE);
+    keypad(stdscr, TRUE);
+    while (is_running())
+    {
+        ch = getch();
+        TRACE_BEGIN("input");
+        switch (ch)
+        {
+        case KEY_UP:
+        case 'w':
+        {
+            Coord new_y = heli.get_y() - 1;
+            if (new_y > 1 && !is_position_occupied<Config>(heli.get_x(), new_y))
+                heli.set_y(new_y);
+            break;
+        }
+        case KEY_DOWN:
+        case 's':
+        {
+            Coord new_y = heli.get_y() + 1;
+            if (new_y < Config::height() - 2 && !is_position_occupied<Config>(heli.get_x(), new_y))
+                heli.set_y(new_y);
+            break;
+        }
+        case KEY_LEFT:
+        case 'a':
+        {
+            Coord new_x = heli.get_x() - 1;
+            if (new_x > 1 && !is_position_occupied<Config>(new_x, heli.get_y()))
+                heli.set_x(new_x);
+            heli.set_last_horizontal_direction(-1);
+            break;
+        }
+        case KEY_RIGHT:
+        case 'd':
+        {
+            Coord new_x = heli.get_x() + 1;
+            if (new_x < Config::width() - 2 && !is_position_occupied<Config>(new_x, heli.get_y()))
+                heli.set_x(new_x);
+            heli.set_last_horizontal_direction(1);
+            break;
+        }
+        case ' ':
+            if (heli.can_fire())
+            {
+                heli.fire();
+                int missile_direction = heli.get_last_horizontal_direction();
+                Coord missile_start_x = heli.get_x() + missile_direction;
+                Missile *m = new Missile(missile_start_x, heli.get_y(), missile_direction);
+                LOG_EVENT(EVENT_MISSILE_FIRED, cell(missile_start_x), cell(m->y), missile_direction);
+                {
+                    TRACED_LOCK(mtx_missiles);
+                    missiles.push_back(m);
+                    pthread_mutex_unlock(&mtx_missiles);
+                }
+                m->start();
+            }
+            break;
+        case 'q':
+            LOG_EVENT(EVENT_GAME_OVER, 0, 0, 0);
+            set_running(false);
+            break;
+        default:
+            break;
+        }
+
+        // Reload if near depot
+        if (is_near_depot<Config>(heli.get_x(), heli.get_y()) && heli.get_remaining_missiles() < Config::missile_capacity())
+        {
+            heli.reload_from_depot();
+        }
+        TRACE_END("input");
+
+        sleep_while_running(Config::input_tick());
+    }
+    return nullptr;
+}
+
+// Spectator export (-DSPECTATOR): the render thread copies the world into a
+// POSIX shared-memory segment once per drawn frame, guarded by a seqlock.
+// Observers map it read-only and retry a read if the sequence number was odd
+// or changed while they copied, so they never take a lock or make a system
+// call in the game process. "./game spectate" is such an observer.
+#ifdef SPECTATOR
+const char *const SPECTATOR_SHM = "/dinogame";
+const int SPECTATOR_VERSION = 1;
+const int SPECTATOR_MAX_MISSILES = 256;
+const int SPECTATOR_MAX_DINOSAURS = 64;
+const int SPECTATOR_MAX_TRUCKS = 16;
+
+struct SpectatorEntity
+{
+    float x;
+    float y;
+    int32_t state; // Missile direction, dinosaur health, truck cargo
+};
+
+// Everything an observer sees; plain data so it can be copied as a block
+struct SpectatorWorld
+{
+    int32_t version; // SPECTATOR_VERSION
+    int32_t running;
+    int64_t frame;
+    int32_t width;
+    int32_t height;
+    float heli_x;
+    float heli_y;
+
+    // The status line
+    int32_t remaining_missiles;
+    int32_t depot_missiles;
+    int32_t dinosaur_count;
+
+    // Entity arrays, cut off at their maximum size
+    int32_t num_missiles;
+    int32_t num_dinosaurs;
+    int32_t num_trucks;
+    SpectatorEntity missiles[SPECTATOR_MAX_MISSILES];
+    SpectatorEntity dinosaurs[SPECTATOR_MAX_DINOSAURS];
+    SpectatorEntity trucks[SPECTATOR_MAX_TRUCKS];
+};
+
+struct SpectatorView
+{
+    std::atomic<uint32_t> seq; // Odd while the game is writing
+    SpectatorWorld world;
+};
+
+SpectatorView *spectator_view = nullptr;
+SpectatorWorld spectator_staging; // Filled by the render thread outside the seqlock
+
+// Create the segment; the game runs without it if that fails
+void spectator_open()
+{
+    int fd = shm_open(SPECTATOR_SHM, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return;
+    if (ftruncate(fd, sizeof(SpectatorView)) == 0)
+    {
+        void *p = mmap(nullptr, sizeof(SpectatorView), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            spectator_view = static_cast<SpectatorView *>(p);
+            spectator_view->seq.store(0, std::memory_order_relaxed);
+        }
+    }
+    close(fd);
+}
+
+template <class T>
+SpectatorEntity spectator_entity(T *entity, int state)
+{
+    pthread_mutex_lock(&entity->mtx);
+    SpectatorEntity e = {static_cast<float>(to_double(entity->x)), static_cast<float>(to_double(entity->y)), state};
+    pthread_mutex_unlock(&entity->mtx);
+    return e;
+}
+
+// Gather the world, then copy it into the segment in one seqlock write
+void spectator_publish()
+{
+    if (!spectator_view)
+        return;
+
+    SpectatorWorld &w = spectator_staging;
+    w.version = SPECTATOR_VERSION;
+    w.running = is_running();
+    w.frame++;
+    w.width = Config::width();
+    w.height = Config::height();
+    w.heli_x = static_cast<float>(to_double(heli.get_x()));
+    w.heli_y = static_cast<float>(to_double(heli.get_y()));
+    w.remaining_missiles = heli.get_remaining_missiles();
+    w.depot_missiles = depot.stock();
+
+    w.num_missiles = 0;
+    TRACED_LOCK(mtx_missiles);
+    for (auto m : missiles)
+    {
+        if (m->active && w.num_missiles < SPECTATOR_MAX_MISSILES)
+            w.missiles[w.num_missiles++] = spectator_entity(m, m->direction);
+    }
+    pthread_mutex_unlock(&mtx_missiles);
+
+    w.num_dinosaurs = 0;
+    TRACED_LOCK(mtx_dinosaurs);
+    w.dinosaur_count = static_cast<int32_t>(dinosaurs.size());
+    for (auto d : dinosaurs)
+    {
+        if (d->active && w.num_dinosaurs < SPECTATOR_MAX_DINOSAURS)
+            w.dinosaurs[w.num_dinosaurs++] = spectator_entity(d, d->health);
+    }
+    pthread_mutex_unlock(&mtx_dinosaurs);
+
+    w.num_trucks = 0;
+    TRACED_LOCK(mtx_trucks);
+    for (auto truck : active_trucks)
+    {
+        if (truck->active && w.num_trucks < SPECTATOR_MAX_TRUCKS)
+            w.trucks[w.num_trucks++] = spectator_entity(truck, truck->cargo);
+    }
+    pthread_mutex_unlock(&mtx_trucks);
+
+    uint32_t seq = spectator_view->seq.load(std::memory_order_relaxed);
+    spectator_view->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&spectator_view->world, &w, sizeof(w));
+    spectator_view->seq.store(seq + 2, std::memory_order_release);
+}
+
+// Publish the final state and remove the segment; observers that still
+// have it mapped keep reading that state
+void spectator_close()
+{
+    if (!spectator_view)
+        return;
+    spectator_publish();
+    munmap(spectator_view, sizeof(SpectatorView));
+    spectator_view = nullptr;
+    shm_unlink(SPECTATOR_SHM);
+}
+
+// Observer side: take a consistent copy of the world
+void spectator_read(const SpectatorView *view, SpectatorWorld &out)
+{
+    while (true)
+    {
+        uint32_t before = view->seq.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(&out, &view->world, sizeof(out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (view->seq.load(std::memory_order_relaxed) == before)
+            return;
+    }
+}
+
+// "./game spectate": attach to a running game and print its status line
+int spectate()
+{
+    int fd = shm_open(SPECTATOR_SHM, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        std::cerr << "No game to spectate" << std::endl;
+        return 1;
+    }
+    void *p = mmap(nullptr, sizeof(SpectatorView), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return 1;
+    const SpectatorView *view = static_cast<const SpectatorView *>(p);
+
+    SpectatorWorld world;
+    do
+    {
+        usleep(250000);
+        spectator_read(view, world);
+        if (world.version != SPECTATOR_VERSION)
+            continue;
+        printf("frame %lld  helicopter (%.0f, %.0f)  Remaining missiles: %d  Depot missiles: %d  Dinosaurs: %d  "
+               "Missiles in flight: %d  Trucks: %d\n",
+               static_cast<long long>(world.frame), world.heli_x, world.heli_y, world.remaining_missiles,
+               world.depot_missiles, world.dinosaur_count, world.num_missiles, world.num_trucks);
+        fflush(stdout);
+    } while (world.running || world.version != SPECTATOR_VERSION);
+
+    munmap(p, sizeof(SpectatorView));
+    return 0;
+}
+#endif
+
+// Function to render the scenario
+void *thread_render(void *arg)
+{
+    TRACE_THREAD("thread_render");
+    FrameClock clock;
+    while (is_running())
+    {
+        if (frame_budget.skip_frame())
+        {
+            sleep_while_running(clock.frame_done(Config::render_tick()));
+            continue;
+        }
+
+        TRACE_BEGIN("frame");
+        long long now = now_us();
+        clear();
+        // Draw borders
+        for (int i = 0; i < Config::width(); i++)
+        {
+            mvprintw(0, i, "#");
+            mvprintw(Config::height() - 1, i, "#");
+        }
+        for (int i = 0; i < Config::height(); i++)
+        {
+            mvprintw(i, 0, "#");
+            mvprintw(i, Config::width() - 1, "#");
+        }
+
+        // Reload indicator
+        if (is_near_depot<Config>(heli.get_x(), heli.get_y()))
+        {
+            mvprintw(Config::depot_y() - 1, Config::depot_x(), "R");
+        }
+        else
+        {
+            mvprintw(Config::depot_y() - 1, Config::depot_x(), " ");
+        }
+
+        // Draw helicopter
+        mvprintw(cell(heli.get_y()), cell(heli.get_x()), "H");
+
+        // Draw missiles
+        {
+            TRACED_LOCK(mtx_missiles);
+            for (auto it = missiles.begin(); it != missiles.end();)
+            {
+                if ((*it)->active)
+                {
+                    (*it)->draw(now);
+                    ++it;
+                }
+                else
+                {
+                    retire(*it);
+                    it = missiles.erase(it);
+                }
+            }
+            pthread_mutex_unlock(&mtx_missiles);
+        }
+
+        // Draw dinosaurs
+        {
+            TRACED_LOCK(mtx_dinosaurs);
+            for (auto it = dinosaurs.begin(); it != dinosaurs.end();)
+            {
+                if ((*it)->active)
+                {
+                    (*it)->draw(now);
+                    ++it;
+                }
+                else
+                {
+                    retire(*it);
+                    it = dinosaurs.erase(it);
+                }
+            }
+            pthread_mutex_unlock(&mtx_dinosaurs);
+        }
+
+        // Draw depot
+        mvprintw(Config::depot_y(), Config::depot_x(), "S");
+
+        // Draw active trucks
+        {
+            TRACED_LOCK(mtx_trucks);
+            for (auto it = active_trucks.begin(); it != active_trucks.end();)
+            {
+                if ((*it)->active)
+                {
+                    (*it)->draw(now);
+                    ++it;
+                }
+                else
+                {
+                    retire(*it);
+                    it = active_trucks.erase(it);
+                }
+            }
+            pthread_mutex_unlock(&mtx_trucks);
+        }
+
+        mvprintw(Config::height(), 0, "Remaining missiles: %d  Depot missiles: %d  Dinosaurs: %lu",
+                 heli.get_remaining_missiles(), depot.missiles, dinosaurs.size());
+
+        refresh();
+#ifdef SPECTATOR
+        spectator_publish();
+#endif
+        TRACE_END("frame");
+        sleep_while_running(clock.frame_done(Config::render_tick()));
+    }
+
+    clear();
+    std::string game_over_msg = "Game Over!";
+    mvprintw(Config::height() / 2, (Config::width() - game_over_msg.length()) / 2, "%s", game_over_msg.c_str());
+    refresh();
+
+    return nullptr;
 }
 
-void Depot::helicopter_reload(int amount)
+// Function to manage dinosaurs
+void *thread_dinosaur_manager(void *arg)
 {
-    pthread_mutex_lock(&mtx);
-    while (!(missiles > 0 && !is_truck_unloading))
+    TRACE_THREAD("thread_dinosaur_manager");
+    EVENT_LOG_THREAD();
+    // Spawn the initial dinosaur
     {
-        pthread_cond_wait(&cv_helicopter, &mtx);
+        TRACED_LOCK(mtx_dinosaurs);
+        Coord spawn_y = Config::height() - 2;
+        int initial_direction = (rand() % 2 == 0) ? -1 : 1;
+        Coord spawn_x = (initial_direction == -1) ? Config::width() - 2 : 1;
+        Dinosaur *d = new Dinosaur(spawn_x, spawn_y, Config::hits_to_kill(), initial_direction);
+        dinosaurs.push_back(d);
+        d->start();
+        pthread_mutex_unlock(&mtx_dinosaurs);
     }
 
-    is_helicopter_reloading = true;
-    int reload_amount = std::min(amount, missiles);
-    missiles -= reload_amount;
-    heli.reload(reload_amount);
-    is_helicopter_reloading = false;
+    time_t last_spawn_time = time(nullptr);
+    while (is_running())
+    {
+        time_t current_time = time(nullptr);
 
-    pthread_cond_broadcast(&cv_truck);
-    pthread_mutex_unlock(&mtx);
+        // Spawn a new dinosaur if the time interval t has elapsed
+        if (difftime(current_time, last_spawn_time) >= Config::spawn_interval())
+        {
+            TRACED_LOCK(mtx_dinosaurs);
+
+            // Check if the maximum number of dinosaurs has been reached
+            if (dinosaurs.size() == static_cast<size_t>(Config::max_dinosaurs()))
+            {
+                pthread_mutex_unlock(&mtx_dinosaurs);
+                LOG_EVENT(EVENT_GAME_OVER, 2, 0, 0);
+                set_running(false);
+                break;
+            }
+
+            // Spawn a new dinosaur
+            Coord spawn_y = Config::height() - 2;
+            int initial_direction = (rand() % 2 == 0) ? -1 : 1;
+            Coord spawn_x = (initial_direction == -1) ? Config::width() - 2 : 1;
+            Dinosaur *d = new Dinosaur(spawn_x, spawn_y, Config::hits_to_kill(), initial_direction);
+            dinosaurs.push_back(d);
+            d->start();
+
+            pthread_mutex_unlock(&mtx_dinosaurs);
+
+            last_spawn_time = current_time;
+        }
+
+        sleep_while_running(Config::spawner_tick());
+    }
+    return nullptr;
 }
 
-// Helper function to check if a position is occupied by an active dinosaur or the depot
-bool is_position_occupied(double x, double y)
+// Missile collision detection with dinosaurs
+template <class C>
+void BasicMissile<C>::check_collision()
 {
-    pthread_mutex_lock(&mtx_dinosaurs);
-    for (const auto &d : dinosaurs)
+    TRACE_SCOPE("Missile::check_collision");
+    SweptBox path = sweep(prev_x, y, x, y);
+
+    TRACED_LOCK(mtx_dinosaurs);
+    for (auto d : dinosaurs)
     {
         if (d->active)
         {
-            // Dinosaur body
-            if (static_cast<int>(d->x) == static_cast<int>(x) &&
-                static_cast<int>(d->y) == static_cast<int>(y))
+            SweptBox body;
+            SweptBox head;
+            d->swept_boxes(body, head);
+
+            if (overlaps(path, head))
             {
-                pthread_mutex_unlock(&mtx_dinosaurs);
-                return true;
+                LOG_EVENT(EVENT_HEAD_HIT, cell(x), cell(y), 0);
+                d->take_damage();
+                active = false;
+                break;
             }
-            // Dinosaur head
-            int head_x = static_cast<int>(d->x + d->direction);
-            if (head_x == static_cast<int>(x) &&
-                static_cast<int>(d->y - 1) == static_cast<int>(y))
+
+            // Collision with dinosaur's body (ineffective)
+            if (overlaps(path, body))
             {
-                pthread_mutex_unlock(&mtx_dinosaurs);
-                return true;
+                LOG_EVENT(EVENT_BODY_BLOCK, cell(x), cell(y), 0);
+                active = false;
+                break;
             }
         }
     }
     pthread_mutex_unlock(&mtx_dinosaurs);
+}
 
-    // Depot position
-    if (static_cast<int>(x) == DEPOT_X && static_cast<int>(y) == DEPOT_Y)
-        return true;
+// Dinosaur collision detection with helicopter
+template <class C>
+void BasicDinosaur<C>::check_collision()
+{
+    TRACE_SCOPE("Dinosaur::check_collision");
+    SweptBox body;
+    SweptBox head;
+    swept_boxes(body, head);
 
-    return false;
+    if (heli.met_since(seen_heli_moves, body, head))
+    {
+        LOG_EVENT(EVENT_GAME_OVER, 1, 0, 0);
+        set_running(false);
+    }
 }
 
-const int TRUCK_INTERVAL = 1000000; // 1 second in microseconds
+// The game stopped: wake every entity sleeping on its own condvar. Each
+// entity re-reads 'running' under its own mutex, so none misses the change.
+void wake_entities()
+{
+    TRACED_LOCK(mtx_missiles);
+    for (auto m : missiles)
+        m->wake();
+    pthread_mutex_unlock(&mtx_missiles);
+    TRACED_LOCK(mtx_dinosaurs);
+    for (auto d : dinosaurs)
+        d->wake();
+    pthread_mutex_unlock(&mtx_dinosaurs);
+    TRACED_LOCK(mtx_trucks);
+    for (auto truck : active_trucks)
+        truck->wake();
+    pthread_mutex_unlock(&mtx_trucks);
+}
 
-// Function to manage the truck
-void *thread_truck(void *arg)
+// Stop and free every remaining missile, dinosaur and truck. Entities are
+// taken out of the global lists first so no lock is held while joining.
+void clear_entities()
 {
-    while (is_running())
+    std::vector<Missile *> old_missiles;
+    std::vector<Dinosaur *> old_dinosaurs;
+    std::vector<Truck *> old_trucks;
+
+    TRACED_LOCK(mtx_missiles);
+    old_missiles.swap(missiles);
+    pthread_mutex_unlock(&mtx_missiles);
+    TRACED_LOCK(mtx_dinosaurs);
+    old_dinosaurs.swap(dinosaurs);
+    pthread_mutex_unlock(&mtx_dinosaurs);
+    TRACED_LOCK(mtx_trucks);
+    old_trucks.swap(active_trucks);
+    pthread_mutex_unlock(&mtx_trucks);
+
+    for (auto m : old_missiles)
+        m->stop();
+    for (auto d : old_dinosaurs)
+        d->stop();
+    for (auto truck : old_trucks)
+        truck->stop();
+
+    for (auto m : old_missiles)
+    {
+        retire(m);
+    }
+    for (auto d : old_dinosaurs)
     {
-        usleep(TRUCK_INTERVAL);
+        retire(d);
+    }
+    for (auto truck : old_trucks)
+    {
+        retire(truck);
+    }
+}
 
-        {
-            pthread_mutex_lock(&mtx_trucks);
-            if (!active_trucks.empty())
-            {
-                pthread_mutex_unlock(&mtx_trucks);
-                continue;
-            }
-            pthread_mutex_unlock(&mtx_trucks);
-        }
+#ifdef BENCHMARK
+const int SHUTDOWN_BUDGET_MS = 50;
 
-        Truck *truck = new Truck(1, DEPOT_Y, DEPOT_X - 1, 1);
-        truck->start();
+pthread_mutex_t mtx_quit_key = PTHREAD_MUTEX_INITIALIZER;
+bool quit_key_pressed = false;
 
-        {
-            pthread_mutex_lock(&mtx_trucks);
-            active_trucks.push_back(truck);
-            pthread_mutex_unlock(&mtx_trucks);
-        }
+// Stands in for thread_input with the helicopter hovering over an empty
+// depot: it keeps trying to reload every input tick until 'q' is pressed
+void *thread_hover_at_empty_depot(void *arg)
+{
+    while (is_running())
+    {
+        heli.reload_from_depot();
 
-        while (is_running() && truck->active)
-        {
-            usleep(500000);
-        }
+        pthread_mutex_lock(&mtx_quit_key);
+        bool quit = quit_key_pressed;
+        pthread_mutex_unlock(&mtx_quit_key);
+        if (quit)
+            set_running(false);
+
+        sleep_while_running(Config::input_tick());
     }
     return nullptr;
 }
 
-bool is_near_depot(double heli_x, double heli_y)
+// Run the simulation threads headless with every kind of wait in progress (entity
+// ticks, spawner and truck intervals, a truck unloading, the helicopter trying to
+// reload at an empty depot), then press 'q' and time how long it takes until
+// every thread is joined
+double measure_shutdown_ms()
 {
-    int dx = std::abs(static_cast<int>(heli_x) - DEPOT_X);
-    int dy = std::abs(static_cast<int>(heli_y) - DEPOT_Y);
-    return (dx <= 1 && dy <= 1);
-}
+    set_running(true);
+    heli.set_y(2);
+
+    pthread_t dinosaur_manager_thread_id, truck_thread_id;
+    pthread_create(&dinosaur_manager_thread_id, nullptr, thread_dinosaur_manager, nullptr);
+    pthread_create(&truck_thread_id, nullptr, thread_truck, nullptr);
+#ifdef COROUTINES
+    pthread_t scheduler_thread_id;
+    pthread_create(&scheduler_thread_id, nullptr, thread_scheduler, nullptr);
+#endif
 
-// Function to manage player input
-void *thread_input(void *arg)
-{
-    int ch;
-    nodelay(stdscr, TRUE);
-    keypad(stdscr, TRUE);
-    while (is_running())
     {
-        ch = getch();
-        switch (ch)
+        TRACED_LOCK(mtx_missiles);
+        for (int i = 0; i < 16; i++)
         {
-        case KEY_UP:
-        case 'w':
-        {
-            double new_y = heli.get_y() - 1;
-            if (new_y > 1 && !is_position_occupied(heli.get_x(), new_y))
-                heli.set_y(new_y);
-            break;
+            Missile *m = new Missile(2, 4 + i % 8, 1);
+            missiles.push_back(m);
+            m->start();
         }
-        case KEY_DOWN:
-        case 's':
+        pthread_mutex_unlock(&mtx_missiles);
+    }
+    {
+        TRACED_LOCK(mtx_dinosaurs);
+        for (int i = 0; i < 8; i++)
         {
-            double new_y = heli.get_y() + 1;
-            if (new_y < HEIGHT - 2 && !is_position_occupied(heli.get_x(), new_y))
-                heli.set_y(new_y);
-            break;
+            Dinosaur *d = new Dinosaur(1 + i * 5, Config::height() - 2, Config::hits_to_kill(), i % 2 ? 1 : -1);
+            dinosaurs.push_back(d);
+            d->start();
         }
-        case KEY_LEFT:
-        case 'a':
+        pthread_mutex_unlock(&mtx_dinosaurs);
+    }
+    {
+        // Starts at the depot, which is full, so it sits out its unload time
+        TRACED_LOCK(mtx_trucks);
+        Truck *truck = new Truck(Config::depot_x() - 1, Config::depot_y(), Config::depot_x() - 1,
+                                 Config::truck_speed() * Config::truck_tick() / 1e6, Config::missile_capacity());
+        active_trucks.push_back(truck);
+        truck->start();
+        pthread_mutex_unlock(&mtx_trucks);
+    }
+
+    // Once the truck has unloaded, empty the depot and hover over it with an
+    // empty helicopter
+    usleep(100000);
+    pthread_mutex_lock(&depot.mtx);
+    depot.missiles = 0;
+    pthread_mutex_unlock(&depot.mtx);
+    pthread_mutex_lock(&heli.mtx_remaining_missiles);
+    heli.remaining_missiles = 0;
+    pthread_mutex_unlock(&heli.mtx_remaining_missiles);
+    pthread_t hover_thread_id;
+    pthread_create(&hover_thread_id, nullptr, thread_hover_at_empty_depot, nullptr);
+
+    usleep(100000);
+
+    auto start = std::chrono::steady_clock::now();
+    pthread_mutex_lock(&mtx_quit_key);
+    quit_key_pressed = true;
+    pthread_mutex_unlock(&mtx_quit_key);
+    pthread_join(hover_thread_id, nullptr);
+    pthread_join(dinosaur_manager_thread_id, nullptr);
+    pthread_join(truck_thread_id, nullptr);
+#ifdef COROUTINES
+    pthread_join(scheduler_thread_id, nullptr);
+#endif
+    clear_entities();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#ifdef COROUTINES
+// Run thousands of dinosaur and truck behaviors on the scheduler thread for a
+// second and report how many resumes it managed
+void measure_scheduler()
+{
+    const int num_dinosaurs = 5000;
+    const int num_trucks = 5000;
+
+    set_running(true);
+    heli.set_y(2);
+    unsigned long frames_before = behavior_frames;
+    unsigned long bytes_before = behavior_frame_bytes;
+
+    pthread_t scheduler_thread_id;
+    pthread_create(&scheduler_thread_id, nullptr, thread_scheduler, nullptr);
+    {
+        TRACED_LOCK(mtx_dinosaurs);
+        for (int i = 0; i < num_dinosaurs; i++)
         {
-            double new_x = heli.get_x() - 1;
-            if (new_x > 1 && !is_position_occupied(new_x, heli.get_y()))
-                heli.set_x(new_x);
-            heli.set_last_horizontal_direction(-1);
-            break;
+            Dinosaur *d = new Dinosaur(1 + i % (Config::width() - 3), Config::height() - 2, Config::hits_to_kill(), i % 2 ? 1 : -1);
+            dinosaurs.push_back(d);
+            d->start();
         }
-        case KEY_RIGHT:
-        case 'd':
+        pthread_mutex_unlock(&mtx_dinosaurs);
+    }
+    {
+        // Half drive in, half start at the full depot and unload right away
+        TRACED_LOCK(mtx_trucks);
+        for (int i = 0; i < num_trucks; i++)
         {
-            double new_x = heli.get_x() + 1;
-            if (new_x < WIDTH - 2 && !is_position_occupied(new_x, heli.get_y()))
-                heli.set_x(new_x);
-            heli.set_last_horizontal_direction(1);
-            break;
-        }
-        case ' ':
-            if (heli.can_fire())
-            {
-                heli.fire();
-                int missile_direction = heli.get_last_horizontal_direction();
-                double missile_start_x = heli.get_x() + missile_direction;
-                Missile *m = new Missile(missile_start_x, heli.get_y(), missile_direction);
-                {
-                    pthread_mutex_lock(&mtx_missiles);
-                    missiles.push_back(m);
-                    pthread_mutex_unlock(&mtx_missiles);
-                }
-                m->start();
-            }
-            break;
-        case 'q':
-            set_running(false);
-            break;
-        default:
-            break;
+            Coord start_x = (i % 2) ? 1 : Config::depot_x() - 1;
+            Truck *truck = new Truck(start_x, Config::depot_y(), Config::depot_x() - 1,
+                                     Config::truck_speed() * Config::truck_tick() / 1e6, Config::missile_capacity());
+            active_trucks.push_back(truck);
+            truck->start();
         }
+        pthread_mutex_unlock(&mtx_trucks);
+    }
+
+    unsigned long resumes_before = scheduler.resume_count();
+    auto start = std::chrono::steady_clock::now();
+    usleep(1000000);
+    unsigned long resumes = scheduler.resume_count() - resumes_before;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    set_running(false);
+    pthread_join(scheduler_thread_id, nullptr);
+    clear_entities();
 
-        // Reload if near depot
-        if (is_near_depot(heli.get_x(), heli.get_y()) && heli.get_remaining_missiles() < n)
-        {
-            heli.reload_from_depot();
-        }
+    unsigned long frames = behavior_frames - frames_before;
+    printf("scheduler: %d dinosaurs + %d trucks on one thread: %.0f resumes/s, %.0f bytes per frame\n",
+           num_dinosaurs, num_trucks, resumes / seconds,
+           static_cast<double>(behavior_frame_bytes - bytes_before) / frames);
+}
+#endif
+
+#ifdef CHASE_MODE
+// Step a crowd of chasing dinosaurs while the helicopter sweeps back and
+// forth, and return the time per tick (in nanoseconds)
+double measure_chase(int num_dinosaurs, int ticks)
+{
+    heli.set_y(2);
+    for (int i = 0; i < num_dinosaurs; i++)
+    {
+        Coord spawn_x = 1 + i % (Config::width() - 3);
+        dinosaurs.push_back(new Dinosaur(spawn_x, Config::height() - 2, Config::hits_to_kill(), i % 2 ? 1 : -1));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        // Enter a new cell every few ticks so the field keeps being rebuilt
+        if (tick % 4 == 0)
+            heli.set_x(2 + (tick / 4) % (Config::width() - 4));
+        for (auto d : dinosaurs)
+            d->step();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    clear_entities();
+    return seconds * 1e9 / ticks;
+}
+#endif
 
-        usleep(10000);
+#ifdef EVENT_LOG
+void *log_event_burst(void *arg)
+{
+    event_log_bind_thread();
+    int events = *static_cast<int *>(arg);
+    for (int i = 0; i < events; i++)
+    {
+        log_event(EVENT_HEAD_HIT, i, i, 0);
+        // About one ring's worth per flush interval, so nothing should drop
+        if (i % 256 == 255)
+            usleep(EVENT_FLUSH_US * 256 / EVENT_RING_RECORDS);
     }
     return nullptr;
 }
 
-// Function to render the scenario
-void *thread_render(void *arg)
+// Log from a few threads while the flusher writes, then time log_event on
+// its own and return the cost per event (in nanoseconds)
+double measure_event_log()
 {
-    while (is_running())
+    const int num_threads = 4;
+    int events = 100000;
+
+    set_running(true);
+    event_log_start();
+    pthread_t threads[num_threads];
+    for (int i = 0; i < num_threads; i++)
+        pthread_create(&threads[i], nullptr, log_event_burst, &events);
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], nullptr);
+    set_running(false);
+    event_log_stop();
+
+    // A ring of our own, outside the pool, drained by hand so it never fills
+    EventRing *ring = new EventRing();
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    event_thread.ring = ring;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < events; i++)
     {
-        clear();
-        // Draw borders
-        for (int i = 0; i < WIDTH; i++)
-        {
-            mvprintw(0, i, "#");
-            mvprintw(HEIGHT - 1, i, "#");
-        }
-        for (int i = 0; i < HEIGHT; i++)
+        log_event(EVENT_HEAD_HIT, i, i, 0);
+        ring->tail.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / events;
+    event_thread.ring = nullptr;
+    delete ring;
+    return ns;
+}
+#endif
+
+// Headless benchmark of the entity hot loops for the configuration the game is
+// built with. Build once with and once without -DRUNTIME_CONFIG to compare.
+int run_benchmark()
+{
+    const int num_dinosaurs = 8;
+    const int num_missiles = 256;
+    const int ticks = 20000;
+
+#ifdef EVENT_LOG
+    // First, while the rings are still empty
+    printf("event log: %.1f ns per event on the hot path\n", measure_event_log());
+#endif
+
+    srand(1);
+    heli.set_y(Config::height() - 3);
+
+    for (int i = 0; i < num_dinosaurs; i++)
+    {
+        Coord spawn_x = 1 + (Config::width() - 3) * i / num_dinosaurs;
+        dinosaurs.push_back(new Dinosaur(spawn_x, Config::height() - 2, Config::hits_to_kill(), i % 2 ? 1 : -1));
+    }
+    for (int i = 0; i < num_missiles; i++)
+    {
+        missiles.push_back(new Missile(2 + i % (Config::width() - 4), Config::height() - 3 - i % 3, i % 2 ? 1 : -1));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    long missile_steps = 0;
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        for (auto d : dinosaurs)
         {
-            mvprintw(i, 0, "#");
-            mvprintw(i, WIDTH - 1, "#");
+            d->active = true;
+            d->health = Config::hits_to_kill();
+            d->step();
         }
-
-        // Reload indicator
-        if (is_near_depot(heli.get_x(), heli.get_y()))
+        for (auto m : missiles)
         {
-            mvprintw(DEPOT_Y - 1, DEPOT_X, "R");
+            if (!m->step())
+            {
+                // Relaunch from the opposite border to keep the load constant
+                m->active = true;
+                m->direction = -m->direction;
+                m->x = (m->direction == 1) ? 2 : Config::width() - 3;
+                m->prev_x = m->x;
+            }
+            missile_steps++;
         }
-        else
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+#ifdef RUNTIME_CONFIG
+    const char *build = "runtime";
+#else
+    const char *build = "constexpr";
+#endif
+    printf("%s config: %d ticks, %d dinosaurs, %d missiles: %.3f s (%.1f ns per tick, %.2f ns per missile step)\n",
+           build, ticks, num_dinosaurs, num_missiles, seconds,
+           seconds * 1e9 / ticks, seconds * 1e9 / missile_steps);
+
+    // The same scene with only the motion and swept-box arithmetic, on this
+    // thread and without the per-entity locks, which otherwise dominate the
+    // timing above and hide what folding the configuration saves
+    std::vector<SweptBox> bodies(num_dinosaurs);
+    std::vector<SweptBox> heads(num_dinosaurs);
+    long hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < ticks; tick++)
+    {
+        for (int i = 0; i < num_dinosaurs; i++)
         {
-            mvprintw(DEPOT_Y - 1, DEPOT_X, " ");
+            dinosaurs[i]->advance(1);
+            dinosaurs[i]->swept_boxes_unlocked(bodies[i], heads[i]);
         }
-
-        // Draw helicopter
-        mvprintw(static_cast<int>(heli.get_y()), static_cast<int>(heli.get_x()), "H");
-
-        // Draw missiles
+        for (auto m : missiles)
         {
-            pthread_mutex_lock(&mtx_missiles);
-            for (auto it = missiles.begin(); it != missiles.end();)
+            if (!(m->x > 1 && m->x < Config::width() - 2))
             {
-                if ((*it)->active)
-                {
-                    (*it)->draw();
-                    ++it;
-                }
-                else
-                {
-                    (*it)->join();
-                    delete *it;
-                    it = missiles.erase(it);
-                }
+                m->direction = -m->direction;
+                m->x = (m->direction == 1) ? 2 : Config::width() - 3;
             }
-            pthread_mutex_unlock(&mtx_missiles);
-        }
-
-        // Draw dinosaurs
-        {
-            pthread_mutex_lock(&mtx_dinosaurs);
-            for (auto it = dinosaurs.begin(); it != dinosaurs.end();)
+            m->advance(1);
+            SweptBox path = sweep(m->prev_x, m->y, m->x, m->y);
+            for (int i = 0; i < num_dinosaurs; i++)
             {
-                if ((*it)->active)
-                {
-                    (*it)->draw();
-                    ++it;
-                }
-                else
+                if (overlaps(path, heads[i]) || overlaps(path, bodies[i]))
                 {
-                    (*it)->join();
-                    delete *it;
-                    it = dinosaurs.erase(it);
+                    hits++;
+                    break;
                 }
             }
-            pthread_mutex_unlock(&mtx_dinosaurs);
         }
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%s config, arithmetic only: %.1f ns per tick, %.2f ns per missile step (%ld hits)\n",
+           build, seconds * 1e9 / ticks, seconds * 1e9 / missile_steps, hits);
+
+    // Memory per entity. The coordinate type only changes the Coord members;
+    // the mutex, condition variable and thread handle every entity locks and
+    // sleeps with take most of it, whatever the type.
+    struct EntitySize
+    {
+        const char *name;
+        size_t size;
+        int coords; // Coord members
+    };
+    const EntitySize sizes[] = {
+        {"missile", sizeof(Missile), 3},   // x, y, prev_x
+        {"dinosaur", sizeof(Dinosaur), 5}, // x, y, prev_x, prev_y, vertical_velocity
+        {"truck", sizeof(Truck), 5},       // x, y, prev_x, target_x, speed
+    };
+    const size_t sync_bytes = sizeof(pthread_mutex_t) + sizeof(pthread_cond_t) + sizeof(pthread_t);
+    printf("coordinate size %zu bytes (%zu as double); helicopter %zu bytes\n", sizeof(Coord), sizeof(double),
+           sizeof(Helicopter));
+    for (const EntitySize &e : sizes)
+    {
+        size_t coord_bytes = e.coords * sizeof(Coord);
+        size_t double_bytes = e.coords * sizeof(double);
+        printf("%s: %zu bytes, %zu of them mutex, condvar and thread handle; coordinates %zu bytes "
+               "(%zu as double, saving up to %zu before padding)\n",
+               e.name, e.size, sync_bytes, coord_bytes, double_bytes, double_bytes - coord_bytes);
+    }
 
-        // Draw depot
-        mvprintw(DEPOT_Y, DEPOT_X, "S");
+    clear_entities();
+
+#ifdef CHASE_MODE
+    // Per-dinosaur cost should stay flat as the crowd grows; the field is
+    // rebuilt per helicopter cell, not per dinosaur
+    double small_ns = measure_chase(1000, 400);
+    unsigned long rebuilds_before = flow_field.rebuilds;
+    double rebuild_seconds_before = flow_field.rebuild_seconds;
+    double large_ns = measure_chase(10000, 400);
+    printf("chase: 1000 dinosaurs %.1f ns per dinosaur step, 10000 dinosaurs %.1f ns per dinosaur step; "
+           "flow field rebuilt %lu times, %.1f us each\n",
+           small_ns / 1000, large_ns / 10000, flow_field.rebuilds - rebuilds_before,
+           (flow_field.rebuild_seconds - rebuild_seconds_before) * 1e6 / (flow_field.rebuilds - rebuilds_before));
+#endif
+
+#ifdef COROUTINES
+    measure_scheduler();
+#endif
+
+    double shutdown_ms = measure_shutdown_ms();
+    printf("shutdown: %.2f ms from stop to all threads joined (budget %d ms)\n", shutdown_ms, SHUTDOWN_BUDGET_MS);
+    return shutdown_ms < SHUTDOWN_BUDGET_MS ? 0 : 1;
+}
+#endif
+
+// Discrete-event simulation (-DEVENT_SIM): headless games in which every
+// motion is analytic (straight lines, bounces, jump parabolas), so instead
+// of stepping entities tick by tick the engine computes when the next
+// interesting thing happens and jumps straight to it. Each entity keeps a
+// motion segment; any change to it bumps its version, which makes the events
+// predicted from the old segment stale. Collisions are taken at the moment
+// centres cross in x while in the same row, not from per-tick swept cells,
+// so outcomes follow the threaded game closely but not tick for tick.
+#ifdef EVENT_SIM
+const int EVENT_SIM_DEFAULT_GAMES = 1000;
+const double EVENT_SIM_MAX_SECONDS = 3600; // Games still going after this are cut off
+const double EVENT_SIM_FIRE_INTERVAL = 0.25;
+
+enum SimEventType
+{
+    SIM_SPAWN,          // Next dinosaur is due
+    SIM_FIRE,           // Helicopter may fire
+    SIM_BOUNCE,         // Dinosaur reaches a border
+    SIM_JUMP,           // Dinosaur takes off
+    SIM_LAND,           // Dinosaur is back on the ground
+    SIM_MISSILE_BORDER, // Missile leaves the screen
+    SIM_HEAD_HIT,       // Missile meets a dinosaur's head
+    SIM_BODY_BLOCK,     // Missile meets a dinosaur's body
+    SIM_CATCH,          // Dinosaur reaches the helicopter
+    SIM_TRUCK_ARRIVE,   // Truck reaches the depot
+    SIM_TRUCK_GONE      // Truck has unloaded and left the screen
+};
 
-        // Draw active trucks
+struct SimEvent
+{
+    double time;
+    int type;
+    int a; // Entity indices, -1 if unused
+    int b;
+    unsigned version_a;
+    unsigned version_b;
+    int amount; // Truck cargo
+
+    // Earliest event on top of the priority queue
+    bool operator<(const SimEvent &other) const { return time > other.time; }
+};
+
+// x(t) = x0 + vx (t - t0); while airborne y(t) = y0 + vy (t - t0) + gravity (t - t0)^2 / 2
+struct SimBody
+{
+    double t0;
+    double x0;
+    double vx; // In cells per second
+    double y0;
+    double vy;
+    bool airborne;
+    bool alive;
+    unsigned version;
+    int health;
+
+    double x(double t) const { return x0 + vx * (t - t0); }
+    double y(double t) const
+    {
+        double dt = t - t0;
+        return airborne ? y0 + vy * dt + Config::gravity() * dt * dt / 2 : y0;
+    }
+
+    // Start a new segment at time t from wherever the old one got to
+    void rebase(double t)
+    {
+        double new_x = x(t);
+        double new_y = y(t);
+        if (airborne)
+            vy += Config::gravity() * (t - t0);
+        x0 = new_x;
+        y0 = new_y;
+        t0 = t;
+        version++;
+    }
+};
+
+struct SimStats
+{
+    double seconds;
+    unsigned long events;
+    unsigned long stale_events;
+    int fired;
+    int head_hits;
+    int body_blocks;
+    int kills;
+    int deliveries;
+    int caught;   // Games lost to a dinosaur reaching the helicopter
+    int overrun;  // Games lost to too many dinosaurs
+    int cut_off;  // Games still going at EVENT_SIM_MAX_SECONDS
+};
+
+// One game: the helicopter hovers over the depot where it starts, reloads
+// whenever it can and fires at the nearest dinosaur coming its way
+class EventSim
+{
+public:
+    EventSim(SimStats &stats)
+        : stats(stats), now(0), heli_x(Config::width() / 2), heli_y(Config::height() - 3),
+          heli_missiles(Config::missile_capacity()), depot_missiles(Config::missile_capacity()),
+          trucks(0), in_transit(0), alive_dinosaurs(0)
+    {
+    }
+
+    void run(double max_seconds)
+    {
+        schedule(0, SIM_SPAWN);
+        schedule(EVENT_SIM_FIRE_INTERVAL, SIM_FIRE);
+        while (!events.empty())
         {
-            pthread_mutex_lock(&mtx_trucks);
-            for (auto it = active_trucks.begin(); it != active_trucks.end();)
+            SimEvent e = events.top();
+            events.pop();
+            if (e.time > max_seconds)
             {
-                if ((*it)->active)
-                {
-                    (*it)->draw();
-                    ++it;
-                }
-                else
-                {
-                    (*it)->join();
-                    delete *it;
-                    it = active_trucks.erase(it);
-                }
+                now = max_seconds;
+                stats.cut_off++;
+                break;
             }
-            pthread_mutex_unlock(&mtx_trucks);
+            if (is_stale(e))
+            {
+                stats.stale_events++;
+                continue;
+            }
+            now = e.time;
+            stats.events++;
+            if (!handle(e))
+                break;
         }
-
-        mvprintw(HEIGHT, 0, "Remaining missiles: %d  Depot missiles: %d  Dinosaurs: %lu",
-                 heli.get_remaining_missiles(), depot.missiles, dinosaurs.size());
-
-        refresh();
-        usleep(25000);
+        stats.seconds += now;
     }
 
-    clear();
-    std::string game_over_msg = "Game Over!";
-    mvprintw(HEIGHT / 2, (WIDTH - game_over_msg.length()) / 2, "%s", game_over_msg.c_str());
-    refresh();
-    nodelay(stdscr, FALSE);
-    getch();
+private:
+    SimStats &stats;
+    double now;
+    int heli_x;
+    int heli_y;
+    int heli_missiles;
+    int depot_missiles;
+    int trucks;
+    int in_transit;
+    int alive_dinosaurs;
+    std::vector<SimBody> dinosaurs;
+    std::vector<SimBody> missiles;
+    std::priority_queue<SimEvent> events;
+
+    static int ground() { return Config::height() - 2; }
+    static int row(double y) { return static_cast<int>(y); }
+
+    void schedule(double time, int type, int a = -1, unsigned version_a = 0, int b = -1, unsigned version_b = 0,
+                  int amount = 0)
+    {
+        SimEvent e = {time, type, a, b, version_a, version_b, amount};
+        events.push(e);
+    }
 
-    // Clean up remaining trucks
+    bool is_stale(const SimEvent &e) const
     {
-        pthread_mutex_lock(&mtx_trucks);
-        for (auto truck : active_trucks)
+        switch (e.type)
         {
-            truck->join();
-            delete truck;
+        case SIM_BOUNCE:
+        case SIM_JUMP:
+        case SIM_LAND:
+        case SIM_CATCH:
+            return !dinosaurs[e.a].alive || dinosaurs[e.a].version != e.version_a;
+        case SIM_MISSILE_BORDER:
+            return !missiles[e.a].alive;
+        case SIM_HEAD_HIT:
+        case SIM_BODY_BLOCK:
+            return !missiles[e.a].alive || !dinosaurs[e.b].alive || dinosaurs[e.b].version != e.version_b;
+        default:
+            return false;
         }
-        active_trucks.clear();
-        pthread_mutex_unlock(&mtx_trucks);
     }
 
-    return nullptr;
-}
-
-// Function to manage dinosaurs
-void *thread_dinosaur_manager(void *arg)
-{
-    // Spawn the initial dinosaur
+    // When a point moving with 'body' (offset by dx, dy) crosses x = target_x
+    // (moving at target_vx) while in row target_row; -1 if it does not
+    double crossing(const SimBody &body, double dx, double dy, double target_x, double target_vx, int target_row) const
     {
-        pthread_mutex_lock(&mtx_dinosaurs);
-        double spawn_y = HEIGHT - 2;
-        int initial_direction = (rand() % 2 == 0) ? -1 : 1;
-        double spawn_x = (initial_direction == -1) ? WIDTH - 2 : 1;
-        Dinosaur *d = new Dinosaur(spawn_x, spawn_y, m, initial_direction);
-        dinosaurs.push_back(d);
-        d->start();
-        pthread_mutex_unlock(&mtx_dinosaurs);
+        double gap = target_x - (body.x(now) + dx);
+        double closing = body.vx - target_vx;
+        if (closing == 0 || gap / closing < 0)
+            return -1;
+        double t = now + gap / closing;
+        return row(body.y(t) + dy) == target_row ? t : -1;
     }
 
-    time_t last_spawn_time = time(nullptr);
-    while (is_running())
+    // Head hit or body block between missile m and dinosaur d, whichever comes first
+    void predict_pair(int m, int d)
     {
-        time_t current_time = time(nullptr);
+        const SimBody &missile = missiles[m];
+        const SimBody &dino = dinosaurs[d];
+        int direction = dino.vx < 0 ? -1 : 1;
+        double missile_x = missile.x(now);
+        double head = crossing(dino, direction, -1, missile_x, missile.vx, row(missile.y0));
+        double body = crossing(dino, 0, 0, missile_x, missile.vx, row(missile.y0));
+        if (head >= 0 && (body < 0 || head <= body))
+            schedule(head, SIM_HEAD_HIT, m, missile.version, d, dino.version);
+        else if (body >= 0)
+            schedule(body, SIM_BODY_BLOCK, m, missile.version, d, dino.version);
+    }
 
-        // Spawn a new dinosaur if the time interval t has elapsed
-        if (difftime(current_time, last_spawn_time) >= t)
+    void predict_missile(int m)
+    {
+        const SimBody &missile = missiles[m];
+        double border = missile.vx < 0 ? 1 : Config::width() - 2;
+        schedule(now + (border - missile.x(now)) / missile.vx, SIM_MISSILE_BORDER, m, missile.version);
+        for (size_t d = 0; d < dinosaurs.size(); d++)
         {
-            pthread_mutex_lock(&mtx_dinosaurs);
+            if (dinosaurs[d].alive)
+                predict_pair(m, d);
+        }
+    }
 
-            // Check if the maximum number of dinosaurs has been reached
-            if (dinosaurs.size() == 4)
-            {
-                pthread_mutex_unlock(&mtx_dinosaurs);
-                set_running(false);
-                break;
-            }
+    void predict_dinosaur(int d)
+    {
+        const SimBody &dino = dinosaurs[d];
+        // A standing or weightless dinosaur never reaches a border or the
+        // ground; the times would divide by zero and NaN breaks the queue order
+        if (dino.vx != 0)
+        {
+            double x = dino.x(now);
+            double border = dino.vx < 0 ? 1 : Config::width() - 2;
+            schedule(now + (border - x) / dino.vx, SIM_BOUNCE, d, dino.version);
+        }
 
-            // Spawn a new dinosaur
-            double spawn_y = HEIGHT - 2;
-            int initial_direction = (rand() % 2 == 0) ? -1 : 1;
-            double spawn_x = (initial_direction == -1) ? WIDTH - 2 : 1;
-            Dinosaur *d = new Dinosaur(spawn_x, spawn_y, m, initial_direction);
-            dinosaurs.push_back(d);
-            d->start();
+        if (dino.airborne)
+        {
+            // Positive root of y0 + vy t + g t^2 / 2 = ground
+            double g = Config::gravity();
+            double rise = ground() - dino.y(now);
+            double vy = dino.vy + g * (now - dino.t0);
+            if (g > 0)
+                schedule(now + (-vy + std::sqrt(vy * vy + 2 * g * rise)) / g, SIM_LAND, d, dino.version);
+        }
+        else if (Config::jump_rate() > 0)
+        {
+            // Jumps come at jump_rate per second, like the per-tick chance
+            double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+            schedule(now - std::log(u) / Config::jump_rate(), SIM_JUMP, d, dino.version);
+        }
 
-            pthread_mutex_unlock(&mtx_dinosaurs);
+        int direction = dino.vx < 0 ? -1 : 1;
+        double head = crossing(dino, direction, -1, heli_x, 0, heli_y);
+        double body = crossing(dino, 0, 0, heli_x, 0, heli_y);
+        double caught = head < 0 ? body : (body < 0 ? head : std::min(head, body));
+        if (caught >= 0)
+            schedule(caught, SIM_CATCH, d, dino.version);
 
-            last_spawn_time = current_time;
+        for (size_t m = 0; m < missiles.size(); m++)
+        {
+            if (missiles[m].alive)
+                predict_pair(m, d);
         }
+    }
 
-        usleep(500000);
+    void reload()
+    {
+        int amount = std::min(Config::missile_capacity() - heli_missiles, depot_missiles);
+        heli_missiles += amount;
+        depot_missiles -= amount;
     }
-    return nullptr;
-}
 
-// Missile collision detection with dinosaurs
-void Missile::check_collision(double prev_x, double curr_x)
-{
-    pthread_mutex_lock(&mtx_dinosaurs);
-    for (auto d : dinosaurs)
+    void dispatch()
     {
-        if (d->active)
+        double travel = (Config::depot_x() - 2) / Config::truck_speed();
+        while (trucks < Config::max_trucks() && depot_missiles + in_transit < Config::missile_capacity())
         {
-            double d_head_x = d->x + d->direction;
-            double d_head_y = d->y - 1;
+            int cargo = Config::missile_capacity() - depot_missiles - in_transit;
+            trucks++;
+            in_transit += cargo;
+            schedule(now + travel, SIM_TRUCK_ARRIVE, -1, 0, -1, 0, cargo);
+        }
+    }
 
-            int missile_y = static_cast<int>(y);
-            if (missile_y == static_cast<int>(d_head_y))
+    // Apply an event; returns false once the game is over
+    bool handle(const SimEvent &e)
+    {
+        switch (e.type)
+        {
+        case SIM_SPAWN:
+        {
+            if (alive_dinosaurs == Config::max_dinosaurs())
             {
-                if ((prev_x <= d_head_x && curr_x >= d_head_x) ||
-                    (prev_x >= d_head_x && curr_x <= d_head_x))
-                {
-                    d->take_damage();
-                    active = false;
-                    break;
-                }
+                stats.overrun++;
+                return false;
             }
-
-            // Collision with dinosaur's body (ineffective)
-            if (missile_y == static_cast<int>(d->y))
+            int direction = (rand() % 2 == 0) ? -1 : 1;
+            SimBody dino = {now, direction == -1 ? Config::width() - 2.0 : 1.0, direction * Config::dinosaur_speed(),
+                            static_cast<double>(ground()), 0, false, true, 0, Config::hits_to_kill()};
+            dinosaurs.push_back(dino);
+            alive_dinosaurs++;
+            predict_dinosaur(dinosaurs.size() - 1);
+            schedule(now + Config::spawn_interval(), SIM_SPAWN);
+            break;
+        }
+        case SIM_FIRE:
+        {
+            // Aim at the nearest dinosaur walking towards the helicopter
+            int target = -1;
+            double nearest = Config::width();
+            for (size_t d = 0; d < dinosaurs.size(); d++)
             {
-                if ((prev_x <= d->x && curr_x >= d->x) ||
-                    (prev_x >= d->x && curr_x <= d->x))
+                double gap = heli_x - dinosaurs[d].x(now);
+                if (dinosaurs[d].alive && gap * dinosaurs[d].vx > 0 && std::abs(gap) < nearest)
                 {
-                    active = false;
-                    break;
+                    nearest = std::abs(gap);
+                    target = d;
                 }
             }
+            if (target >= 0 && heli_missiles > 0)
+            {
+                int direction = dinosaurs[target].x(now) < heli_x ? -1 : 1;
+                SimBody missile = {now, static_cast<double>(heli_x + direction), direction * Config::missile_speed(),
+                                   static_cast<double>(heli_y), 0, false, true, 0, 0};
+                missiles.push_back(missile);
+                heli_missiles--;
+                stats.fired++;
+                predict_missile(missiles.size() - 1);
+                reload();
+                dispatch();
+            }
+            schedule(now + EVENT_SIM_FIRE_INTERVAL, SIM_FIRE);
+            break;
+        }
+        case SIM_BOUNCE:
+        {
+            SimBody &dino = dinosaurs[e.a];
+            dino.rebase(now);
+            dino.x0 = dino.vx < 0 ? 1 : Config::width() - 2;
+            dino.vx = -dino.vx;
+            predict_dinosaur(e.a);
+            break;
+        }
+        case SIM_JUMP:
+        {
+            SimBody &dino = dinosaurs[e.a];
+            dino.rebase(now);
+            dino.airborne = true;
+            dino.vy = Config::jump_strength();
+            predict_dinosaur(e.a);
+            break;
+        }
+        case SIM_LAND:
+        {
+            SimBody &dino = dinosaurs[e.a];
+            dino.rebase(now);
+            dino.airborne = false;
+            dino.y0 = ground();
+            dino.vy = 0;
+            predict_dinosaur(e.a);
+            break;
+        }
+        case SIM_MISSILE_BORDER:
+            missiles[e.a].alive = false;
+            break;
+        case SIM_HEAD_HIT:
+        {
+            missiles[e.a].alive = false;
+            stats.head_hits++;
+            SimBody &dino = dinosaurs[e.b];
+            if (--dino.health <= 0)
+            {
+                dino.alive = false;
+                alive_dinosaurs--;
+                stats.kills++;
+            }
+            break;
+        }
+        case SIM_BODY_BLOCK:
+            missiles[e.a].alive = false;
+            stats.body_blocks++;
+            break;
+        case SIM_CATCH:
+            stats.caught++;
+            return false;
+        case SIM_TRUCK_ARRIVE:
+        {
+            int unloaded = std::min(e.amount, Config::missile_capacity() - depot_missiles);
+            depot_missiles += unloaded;
+            in_transit -= e.amount;
+            stats.deliveries++;
+            reload();
+            double leave = (Config::width() - (Config::depot_x() - 1)) / Config::truck_speed();
+            schedule(now + Config::truck_unload_time() / 1e6 + leave, SIM_TRUCK_GONE);
+            break;
         }
+        case SIM_TRUCK_GONE:
+            trucks--;
+            dispatch();
+            break;
+        }
+        return true;
     }
-    pthread_mutex_unlock(&mtx_dinosaurs);
-}
+};
 
-// Dinosaur collision detection with helicopter
-void Dinosaur::check_collision()
+// Play 'games' seeded games back to back and report how they went
+int run_event_sim(int games)
 {
-    double heli_x = heli.get_x();
-    double heli_y = heli.get_y();
-
-    pthread_mutex_lock(&mtx);
-
-    // Collision with dinosaur's body
-    bool collision_body = (static_cast<int>(x) == static_cast<int>(heli_x) &&
-                           static_cast<int>(y) == static_cast<int>(heli_y));
-
-    // Collision with dinosaur's head
-    int head_x = static_cast<int>(x + direction);
-    bool collision_head = (head_x == static_cast<int>(heli_x) &&
-                           static_cast<int>(y - 1) == static_cast<int>(heli_y));
-
-    pthread_mutex_unlock(&mtx);
+    SimStats stats;
+    memset(&stats, 0, sizeof(stats));
 
-    if (collision_body || collision_head)
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < games; i++)
     {
-        set_running(false);
+        srand(i + 1);
+        EventSim sim(stats);
+        sim.run(EVENT_SIM_MAX_SECONDS);
     }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d games, %.0f s simulated in %.3f s (%.0fx real time), %lu events (%lu stale)\n",
+           games, stats.seconds, wall, stats.seconds / wall, stats.events, stats.stale_events);
+    printf("survival %.1f s on average; lost %d to a dinosaur reaching the helicopter, %d to too many dinosaurs, "
+           "%d still going after %.0f s\n",
+           stats.seconds / games, stats.caught, stats.overrun, stats.cut_off, EVENT_SIM_MAX_SECONDS);
+    printf("%d missiles fired: %d head hits, %d body blocks; %d dinosaurs killed; %d truck deliveries\n",
+           stats.fired, stats.head_hits, stats.body_blocks, stats.kills, stats.deliveries);
+    return 0;
 }
+#endif
 
 // Main function
-int main()
+int main(int argc, char *argv[])
 {
+    init_wait_cond(&cv_running);
+
+#ifdef EVENT_SIM
+    // A trailing number is how many games to simulate
+    int sim_games = EVENT_SIM_DEFAULT_GAMES;
+    if (argc > 1 && argv[argc - 1][0] >= '0' && argv[argc - 1][0] <= '9')
+        sim_games = atoi(argv[--argc]);
+#endif
+
+#ifdef SPECTATOR
+    if (argc > 1 && strcmp(argv[1], "spectate") == 0)
+        return spectate();
+#endif
+
+#ifdef RUNTIME_CONFIG
+    // Apply "name=value" overrides before anything reads the configuration
+    for (int i = 1; i < argc; i++)
+    {
+        if (!runtime_settings.set(argv[i]))
+        {
+            std::cerr << "Unknown or invalid setting: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (!runtime_settings.jump_fits())
+    {
+        std::cerr << "Dinosaur jumps would leave the screen: raise gravity or lower jump_strength" << std::endl;
+        return 1;
+    }
+    heli.set_x(Config::width() / 2);
+    heli.remaining_missiles = Config::missile_capacity();
+    depot.capacity = Config::missile_capacity();
+    depot.missiles = Config::missile_capacity();
+#endif
+
+#ifdef BENCHMARK
+    return run_benchmark();
+#endif
+
+#ifdef EVENT_SIM
+    return run_event_sim(sim_games);
+#endif
+
+    TRACE_THREAD("main");
+
     // Seed random number generator
     srand(time(nullptr));
 
@@ -917,7 +3896,12 @@ int main()
     // Assign the helicopter pointer
     heli_ptr = &heli;
 
-    heli.set_y(HEIGHT - 3);
+    heli.set_y(Config::height() - 3);
+
+    EVENT_LOG_START();
+#ifdef SPECTATOR
+    spectator_open();
+#endif
 
     // Create threads
     pthread_t input_thread_id, render_thread_id, dinosaur_manager_thread_id, truck_thread_id;
@@ -925,47 +3909,50 @@ int main()
     pthread_create(&render_thread_id, nullptr, thread_render, nullptr);
     pthread_create(&dinosaur_manager_thread_id, nullptr, thread_dinosaur_manager, nullptr);
     pthread_create(&truck_thread_id, nullptr, thread_truck, nullptr);
+#ifdef COROUTINES
+    pthread_t scheduler_thread_id;
+    pthread_create(&scheduler_thread_id, nullptr, thread_scheduler, nullptr);
+#endif
 
     // Wait for threads
     pthread_join(input_thread_id, nullptr);
     pthread_join(render_thread_id, nullptr);
     pthread_join(dinosaur_manager_thread_id, nullptr);
     pthread_join(truck_thread_id, nullptr);
+#ifdef COROUTINES
+    pthread_join(scheduler_thread_id, nullptr);
+#endif
 
-    // End ncurses
-    endwin();
+    clear_entities();
+#ifdef SPECTATOR
+    spectator_close();
+#endif
 
-    // Clear remaining missiles
-    {
-        pthread_mutex_lock(&mtx_missiles);
-        for (auto m : missiles)
-        {
-            m->active = false;
-            m->join();
-            delete m;
-        }
-        missiles.clear();
-        pthread_mutex_unlock(&mtx_missiles);
-    }
+    // End ncurses right away: waiting for a key here would hold back the
+    // stats, the event log and the trace, and lose them if the terminal closes
+    endwin();
 
-    // Clear remaining dinosaurs
-    {
-        pthread_mutex_lock(&mtx_dinosaurs);
-        for (auto d : dinosaurs)
-        {
-            d->active = false;
-            d->join();
-            delete d;
-        }
-        dinosaurs.clear();
-        pthread_mutex_unlock(&mtx_dinosaurs);
-    }
+    printf("Game Over!\n");
+    printf("Truck trips: %d delivered, %d wasted\n", dispatcher.delivered, dispatcher.wasted);
+    printf("Depot ran dry %d times, %.1f s on average\n", depot.starvations, depot.average_starvation());
+    printf("Frame budget: %lu overruns; shed work %lu times (skip frames %lu, throttle distant %lu, throttle all %lu), "
+           "gave it back %lu times; %lu frames skipped, %lu throttled steps\n",
+           frame_budget.overruns.load(),
+           frame_budget.degradations[DEGRADE_SKIP_FRAMES] + frame_budget.degradations[DEGRADE_THROTTLE_DISTANT] +
+               frame_budget.degradations[DEGRADE_THROTTLE_ALL],
+           frame_budget.degradations[DEGRADE_SKIP_FRAMES], frame_budget.degradations[DEGRADE_THROTTLE_DISTANT],
+           frame_budget.degradations[DEGRADE_THROTTLE_ALL], frame_budget.recoveries,
+           frame_budget.skipped_frames.load(), frame_budget.throttled_steps.load());
+
+    EVENT_LOG_STOP();
+    TRACE_WRITE();
 
     // Destroy mutexes
     pthread_mutex_destroy(&mtx_missiles);
     pthread_mutex_destroy(&mtx_dinosaurs);
     pthread_mutex_destroy(&mtx_trucks);
     pthread_mutex_destroy(&mtx_running);
+    pthread_cond_destroy(&cv_running);
 
     return 0;
 }